@@ -3,19 +3,36 @@ import platform
 import sys
 
 import sysconfig
-from setuptools import setup
+from setuptools import Command, setup
 from setuptools.extension import Extension
 from distutils.command.install_headers import install_headers
 
 def is_posix():
     return platform.os.name == "posix"
 
+def with_zlib():
+    # compressed sinks, opt out with SPDLOG_PYTHON_NO_ZLIB=1
+    return is_posix() and not os.environ.get('SPDLOG_PYTHON_NO_ZLIB')
+
 def link_libs():
     libs = []
     if is_posix():
         libs.append("stdc++")
+    if with_zlib():
+        libs.append("z")
+    if sys.platform.startswith("linux"):
+        libs.append("rt")  # shm_open before glibc 2.34
     return libs
 
+def define_macros():
+    macros = []
+    if with_zlib():
+        macros.append(('SPDLOG_ENABLE_ZLIB', None))
+    # spdlog._benchmark_layers for tests/binding_overhead.py, opt in with SPDLOG_PYTHON_BENCHMARKS=1
+    if os.environ.get('SPDLOG_PYTHON_BENCHMARKS'):
+        macros.append(('SPDLOG_PYTHON_BENCHMARKS', None))
+    return macros
+
 class get_pybind_include(object):
     def __init__(self, user=False):
         self.user = user
@@ -59,6 +76,38 @@ class install_headers_subdir(install_headers):
             (out, _) = self.copy_file(header, install_dir)
             self.outfiles.append(out)
 
+class benchmark(Command):
+    """Run tests/benchmark_suite.py against the built extension"""
+    description = 'run the benchmark suite, compare with a baseline when one is given'
+    user_options = [
+        ('quick', None, 'smaller matrix'),
+        ('output=', None, 'write the results as JSON'),
+        ('baseline=', None, 'JSON results of an earlier run to compare against'),
+    ]
+    boolean_options = ['quick']
+
+    def initialize_options(self):
+        self.quick = False
+        self.output = None
+        self.baseline = None
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        import subprocess
+        self.run_command('build_ext')
+        build_ext = self.get_finalized_command('build_ext')
+        args = [sys.executable, os.path.join('tests', 'benchmark_suite.py')]
+        if self.quick:
+            args.append('--quick')
+        if self.output:
+            args += ['--output', self.output]
+        if self.baseline:
+            args += ['--baseline', self.baseline]
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(filter(None, [build_ext.build_lib, os.environ.get('PYTHONPATH')])))
+        subprocess.check_call(args, env=env)
+
 setup(
     name='spdlog',
     version='2.0.6',
@@ -67,8 +116,8 @@ setup(
     description='python wrapper around C++ spdlog logging library (https://github.com/bodgergely/spdlog-python)',
     license='MIT',
     long_description='python wrapper (https://github.com/bodgergely/spdlog-python) around C++ spdlog (http://github.com/gabime/spdlog.git) logging library.',
-    setup_requires=['pybind11>=2.2', 'wheel', 'pytest-runner'],
-    install_requires=['pybind11>=2.2'],
+    setup_requires=['pybind11>=2.6', 'wheel', 'pytest-runner'],
+    install_requires=['pybind11>=2.6'],
     tests_require=['pytest'],
     ext_modules=[
         Extension(
@@ -76,11 +125,12 @@ setup(
             ['src/pyspdlog.cpp'],
             include_dirs=get_include_dirs(),
             libraries=link_libs(),
+            define_macros=define_macros(),
             extra_compile_args=["-std=c++11", "-v"],
             language='c++11'
         )
     ],
     headers=include_dir_files('spdlog/include/spdlog'),
-    cmdclass={'install_headers': install_headers_subdir},
+    cmdclass={'install_headers': install_headers_subdir, 'benchmark': benchmark},
     zip_safe=False,
 )
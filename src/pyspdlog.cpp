@@ -13,6 +13,10 @@ using namespace pybind11::literals;
 #include <spdlog/spdlog.h>
 #include <spdlog/async.h>
 #include <spdlog/async_logger.h>
+#include <spdlog/details/file_helper.h>
+#include <spdlog/details/os.h>
+#include <spdlog/pattern_formatter.h>
+#include <spdlog/sinks/base_sink.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/daily_file_sink.h>
 #include <spdlog/sinks/null_sink.h>
@@ -23,15 +27,57 @@ using namespace pybind11::literals;
 #ifndef _WIN32
 #include <spdlog/sinks/syslog_sink.h>
 #endif
+#ifdef SPDLOG_FMT_EXTERNAL
+#include <fmt/args.h>
+#else
+#include <spdlog/fmt/bundled/args.h>
+#endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#ifdef SPDLOG_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
 namespace spd = spdlog;
 namespace py = pybind11;
 
@@ -39,37 +85,201 @@ namespace { // Avoid cluttering the global namespace.
 
 class Logger;
 
-bool g_async_mode_on = false;
-auto g_async_overflow_policy = spdlog::async_overflow_policy::block;
+// Module wide defaults, read by constructors that can run on any thread without the GIL
+// on free-threaded builds.
+std::atomic<bool> g_async_mode_on{ false };
+std::atomic<spd::async_overflow_policy> g_async_overflow_policy{ spd::async_overflow_policy::block };
+std::atomic<bool> g_release_gil{ false };
 
-std::unordered_map<std::string, Logger*> g_loggers;
+// The registry is an immutable snapshot swapped on every change, writers copy it under
+// mutex_loggers and lookups only take it with std::atomic_load. That is a short lock of its own
+// in libstdc++, held for the reference count update only, never while a writer copies the map.
+// Loggers are created and dropped rarely, copying the map then is cheap. Entries are weak, the
+// Python objects own the loggers and a lookup racing with the last reference finds nothing.
+typedef std::unordered_map<std::string, std::weak_ptr<Logger>> logger_map;
+std::shared_ptr<const logger_map> g_loggers = std::make_shared<const logger_map>();
+// serializes writers of the snapshot, lookups never take it
 std::mutex mutex_loggers;
 
-void register_logger(const std::string& name, Logger* logger)
+template <typename Update>
+void update_loggers(const Update& update)
 {
     std::lock_guard<std::mutex> lck(mutex_loggers);
-    g_loggers[name] = logger;
+    auto loggers = std::make_shared<logger_map>(*std::atomic_load(&g_loggers));
+    update(*loggers);
+    std::atomic_store(&g_loggers, std::shared_ptr<const logger_map>(std::move(loggers)));
 }
 
-Logger* access_logger(const std::string& name)
+void register_logger(const std::string& name, const std::shared_ptr<Logger>& logger)
 {
-    std::lock_guard<std::mutex> lck(mutex_loggers);
-    return g_loggers[name];
+    update_loggers([&](logger_map& loggers) { loggers[name] = logger; });
+}
+
+std::shared_ptr<Logger> access_logger(const std::string& name)
+{
+    auto loggers = std::atomic_load(&g_loggers);
+    auto it = loggers->find(name);
+    return it == loggers->end() ? nullptr : it->second.lock();
 }
 
 void remove_logger(const std::string& name)
 {
-    std::lock_guard<std::mutex> lck(mutex_loggers);
-    g_loggers[name] = nullptr;
-    g_loggers.erase(name);
+    update_loggers([&](logger_map& loggers) { loggers.erase(name); });
+}
+
+// Called when a Logger is destroyed, a newer logger registered under the same name is kept.
+void remove_expired_logger(const std::string& name)
+{
+    update_loggers([&](logger_map& loggers) {
+        auto it = loggers.find(name);
+        if (it != loggers.end() && it->second.expired())
+            loggers.erase(it);
+    });
+}
+
+std::vector<std::shared_ptr<Logger>> access_logger_all()
+{
+    auto loggers = std::atomic_load(&g_loggers);
+    std::vector<std::shared_ptr<Logger>> all;
+    for (const auto& entry : *loggers)
+        if (auto logger = entry.second.lock())
+            all.push_back(std::move(logger));
+    return all;
 }
 
 void remove_logger_all()
 {
-    std::lock_guard<std::mutex> lck(mutex_loggers);
-    g_loggers.clear();
+    update_loggers([](logger_map& loggers) { loggers.clear(); });
+}
+
+using format_arg_store = fmt::dynamic_format_arg_store<fmt::format_context>;
+
+// Adds a python object to the fmt argument store without going through str() for ints, floats, bools and strings.
+// bools are rendered the way python prints them.
+// Strings and bytes are referenced in place, so the objects must stay alive until formatting is done.
+// Objects that need a str() call are kept alive in keep_alive.
+template <typename Pusher>
+void push_format_arg(py::handle obj, std::vector<py::object>& keep_alive, const Pusher& push)
+{
+    PyObject* o = obj.ptr();
+    if (PyBool_Check(o)) {
+        push(fmt::string_view(o == Py_True ? "True" : "False"));
+        return;
+    }
+    if (PyLong_CheckExact(o)) {
+        int overflow = 0;
+        long long value = PyLong_AsLongLongAndOverflow(o, &overflow);
+        if (!overflow) {
+            push(value);
+            return;
+        }
+    } else if (PyFloat_CheckExact(o)) {
+        push(PyFloat_AS_DOUBLE(o));
+        return;
+    } else if (PyUnicode_Check(o)) {
+        Py_ssize_t size = 0;
+        const char* data = PyUnicode_AsUTF8AndSize(o, &size);
+        if (data == nullptr)
+            throw py::error_already_set();
+        push(fmt::string_view(data, (size_t)size));
+        return;
+    } else if (PyBytes_Check(o)) {
+        push(fmt::string_view(PyBytes_AS_STRING(o), (size_t)PyBytes_GET_SIZE(o)));
+        return;
+    }
+    keep_alive.push_back(py::str(obj));
+    Py_ssize_t size = 0;
+    const char* data = PyUnicode_AsUTF8AndSize(keep_alive.back().ptr(), &size);
+    if (data == nullptr)
+        throw py::error_already_set();
+    push(fmt::string_view(data, (size_t)size));
+}
+
+struct positional_arg_pusher {
+    format_arg_store& store;
+    template <typename T>
+    void operator()(const T& value) const { store.push_back(value); }
+};
+
+struct named_arg_pusher {
+    format_arg_store& store;
+    const char* name;
+    template <typename T>
+    void operator()(const T& value) const { store.push_back(fmt::arg(name, value)); }
+};
+
+void build_format_args(const py::args& args, const py::kwargs& kwargs, format_arg_store& store, std::vector<py::object>& keep_alive)
+{
+    store.reserve(args.size() + kwargs.size(), kwargs.size());
+    for (py::handle arg : args) {
+        push_format_arg(arg, keep_alive, positional_arg_pusher{ store });
+    }
+    for (auto item : kwargs) {
+        const char* name = PyUnicode_AsUTF8(item.first.ptr());
+        if (name == nullptr)
+            throw py::error_already_set();
+        push_format_arg(item.second, keep_alive, named_arg_pusher{ store, name });
+    }
 }
 
+// Borrows the bytes of a log message straight from the python object: the UTF-8 buffer of a str,
+// the contents of bytes or any contiguous buffer protocol object (bytearray, memoryview, ...).
+// Any other object is logged as str(obj). Must be destroyed with the GIL held.
+class MessageView {
+public:
+    explicit MessageView(py::handle obj)
+    {
+        PyObject* o = obj.ptr();
+        if (PyUnicode_Check(o)) {
+            _view = utf8_view(o);
+        } else if (PyBytes_Check(o)) {
+            _view = spd::string_view_t(PyBytes_AS_STRING(o), (size_t)PyBytes_GET_SIZE(o));
+        } else if (PyObject_CheckBuffer(o)) {
+            if (PyObject_GetBuffer(o, &_buffer, PyBUF_SIMPLE) != 0)
+                throw py::error_already_set();
+            _has_buffer = true;
+            _view = spd::string_view_t(static_cast<const char*>(_buffer.buf), (size_t)_buffer.len);
+        } else {
+            _str = py::str(obj);
+            _view = utf8_view(_str.ptr());
+        }
+    }
+    MessageView(MessageView&& other) noexcept
+        : _buffer(other._buffer)
+        , _has_buffer(other._has_buffer)
+        , _str(std::move(other._str))
+        , _view(other._view)
+    {
+        other._has_buffer = false;
+    }
+    ~MessageView()
+    {
+        if (_has_buffer)
+            PyBuffer_Release(&_buffer);
+    }
+    MessageView(const MessageView&) = delete;
+    MessageView& operator=(const MessageView&) = delete;
+    MessageView& operator=(MessageView&&) = delete;
+
+    spd::string_view_t view() const { return _view; }
+
+private:
+    static spd::string_view_t utf8_view(PyObject* o)
+    {
+        // zero copy for ascii strings, otherwise the UTF-8 form is cached on the str object
+        Py_ssize_t size = 0;
+        const char* data = PyUnicode_AsUTF8AndSize(o, &size);
+        if (data == nullptr)
+            throw py::error_already_set();
+        return spd::string_view_t(data, (size_t)size);
+    }
+
+    Py_buffer _buffer{};
+    bool _has_buffer{ false };
+    py::object _str;
+    spd::string_view_t _view;
+};
+
 class LogLevel {
 public:
     const static int trace{ (int)spd::level::trace };
@@ -81,609 +291,4769 @@ public:
     const static int off{ (int)spd::level::off };
 };
 
-class Sink {
+// Sink with a time bound on how long records may stay unflushed, see policy_flusher.
+class timed_flush_sink : public spd::sinks::sink {
 public:
-    Sink() {}
-    Sink(const spd::sink_ptr& sink)
-        : _sink(sink)
+    virtual void flush_if_due(std::chrono::steady_clock::time_point now) = 0;
+    virtual std::chrono::milliseconds max_interval() const = 0;
+};
+
+// Decorates a sink with a flush policy: flush once max_bytes of payload are pending or
+// max_interval has elapsed since the last flush, whichever comes first. The interval is
+// enforced by the policy_flusher thread, so quiet sinks are still flushed on time.
+class flush_policy_sink : public timed_flush_sink {
+public:
+    flush_policy_sink(spd::sink_ptr inner, size_t max_bytes, std::chrono::milliseconds max_interval)
+        : _inner(std::move(inner))
+        , _max_bytes(max_bytes)
+        , _max_interval(max_interval)
+        , _last_flush(std::chrono::steady_clock::now())
     {
+        set_level(_inner->level());
     }
-    virtual ~Sink() {}
-    virtual void log(const spd::details::log_msg& msg)
+
+    void log(const spd::details::log_msg& msg) override
     {
-        _sink->log(msg);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _inner->log(msg);
+        _pending += msg.payload.size();
+        if (_max_bytes > 0 && _pending >= _max_bytes)
+            flush_();
     }
-    bool should_log(int msg_level) const
+    void flush() override
     {
-        return _sink->should_log((spd::level::level_enum)msg_level);
+        std::lock_guard<std::mutex> lock(_mutex);
+        flush_();
     }
-    void set_level(int log_level)
+    void set_pattern(const std::string& pattern) override
     {
-        _sink->set_level((spd::level::level_enum)log_level);
+        _inner->set_pattern(pattern);
     }
-    int level() const
+    void set_formatter(std::unique_ptr<spd::formatter> sink_formatter) override
     {
-        return (int)_sink->level();
+        _inner->set_formatter(std::move(sink_formatter));
     }
 
-    spd::sink_ptr get_sink() const { return _sink; }
+    void flush_if_due(std::chrono::steady_clock::time_point now) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending > 0 && _max_interval.count() > 0 && now - _last_flush >= _max_interval)
+            flush_();
+    }
 
-protected:
-    spd::sink_ptr _sink{ nullptr };
+    const spd::sink_ptr& inner() const { return _inner; }
+    size_t max_bytes() const { return _max_bytes; }
+    // held across a fork, see lock_for_fork
+    std::mutex& mutex() { return _mutex; }
+    std::chrono::milliseconds max_interval() const override { return _max_interval; }
+
+private:
+    void flush_()
+    {
+        _inner->flush();
+        _pending = 0;
+        _last_flush = std::chrono::steady_clock::now();
+    }
+
+    spd::sink_ptr _inner;
+    const size_t _max_bytes;
+    const std::chrono::milliseconds _max_interval;
+    std::mutex _mutex;
+    size_t _pending{ 0 };
+    std::chrono::steady_clock::time_point _last_flush;
 };
 
-// template <class sink_type>
-// class generic_sink : public Sink {
-// public:
-//     generic_sink() {
-//         _sink = std::make_shared<sink_type>();
-//     }
-// };
+// Guards the lists of objects the fork hooks visit, see before_fork.
+std::mutex mutex_fork;
 
-// class stdout_sink_st : public generic_sink<spdlog::sinks::stdout_sink_st> { };
-// class stdout_sink_mt : public generic_sink<spdlog::sinks::stdout_sink_mt> { };
+template <typename T>
+void erase_fork_entry(std::vector<T*>& entries, T* entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_fork);
+    entries.erase(std::remove(entries.begin(), entries.end(), entry), entries.end());
+}
 
-class stdout_sink_st : public Sink {
+// An object running a thread of its own. The lock of its state and the sinks its thread writes
+// to are held across a fork, then the forked child, which has none of the threads, restarts it.
+class fork_thread_owner {
 public:
-    stdout_sink_st()
-    {
-        _sink = std::make_shared<spdlog::sinks::stdout_sink_st>();
-    }
+    virtual ~fork_thread_owner() = default;
+    virtual std::mutex* fork_mutex() { return nullptr; }
+    virtual std::vector<spd::sink_ptr> fork_sinks() const { return {}; }
+    // In a forked child, after the locks are released.
+    virtual void restart_after_fork() = 0;
 };
 
-class stdout_sink_mt : public Sink {
+std::vector<fork_thread_owner*> g_thread_owners;
+
+void add_thread_owner(fork_thread_owner* owner)
+{
+    std::lock_guard<std::mutex> lock(mutex_fork);
+    g_thread_owners.push_back(owner);
+}
+
+// A thread that was not copied into a forked child: destroying or joining it would never return,
+// the handle is leaked instead.
+void abandon_thread(std::thread& thread)
+{
+    if (thread.joinable())
+        new std::thread(std::move(thread));
+}
+
+// Single background thread enforcing the time bound of every timed_flush_sink. Started on
+// first use; sinks are held weakly so dropping the last logger releases the file.
+class policy_flusher : public fork_thread_owner {
 public:
-    stdout_sink_mt()
+    static policy_flusher& instance()
     {
-        _sink = std::make_shared<spdlog::sinks::stdout_sink_mt>();
+        static policy_flusher flusher;
+        return flusher;
     }
-};
 
-class stdout_color_sink_st : public Sink {
-public:
-    stdout_color_sink_st()
+    void add(const std::shared_ptr<timed_flush_sink>& sink)
     {
-        _sink = std::make_shared<spdlog::sinks::stdout_color_sink_st>();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sinks.push_back(sink);
+        if (!_thread.joinable())
+            _thread = std::thread([this] { run_(); });
+        _cv.notify_one();
     }
-};
 
-class stdout_color_sink_mt : public Sink {
-public:
-    stdout_color_sink_mt()
+    ~policy_flusher()
     {
-        _sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+        erase_fork_entry(g_thread_owners, static_cast<fork_thread_owner*>(this));
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_one();
+        if (_thread.joinable())
+            _thread.join();
     }
-};
 
-class stderr_sink_st : public Sink {
-public:
-    stderr_sink_st()
+    std::mutex* fork_mutex() override { return &_mutex; }
+
+    void restart_after_fork() override
     {
-        _sink = std::make_shared<spdlog::sinks::stderr_sink_st>();
+        abandon_thread(_thread);
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_sinks.empty() && !_stop)
+            _thread = std::thread([this] { run_(); });
     }
-};
 
-class stderr_sink_mt : public Sink {
-public:
-    stderr_sink_mt()
+private:
+    policy_flusher()
     {
-        _sink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
+        add_thread_owner(this);
     }
-};
 
-class stderr_color_sink_st : public Sink {
-public:
-    stderr_color_sink_st()
+    void run_()
     {
-        _sink = std::make_shared<spdlog::sinks::stderr_color_sink_st>();
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stop) {
+            // wake up often enough for the tightest policy, but not more than every 1ms
+            auto tick = std::chrono::milliseconds(1000);
+            std::vector<std::shared_ptr<timed_flush_sink>> live;
+            for (auto it = _sinks.begin(); it != _sinks.end();) {
+                if (auto sink = it->lock()) {
+                    tick = std::min(tick, std::max(sink->max_interval() / 2, std::chrono::milliseconds(1)));
+                    live.push_back(std::move(sink));
+                    ++it;
+                } else {
+                    it = _sinks.erase(it);
+                }
+            }
+            lock.unlock();
+            auto now = std::chrono::steady_clock::now();
+            for (auto& sink : live) {
+                try {
+                    sink->flush_if_due(now);
+                } catch (const std::exception& ex) {
+                    std::cerr << "[spdlog] flush policy error: " << ex.what() << std::endl;
+                }
+            }
+            live.clear();
+            lock.lock();
+            _cv.wait_for(lock, tick, [this] { return _stop; });
+        }
     }
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::weak_ptr<timed_flush_sink>> _sinks;
+    std::thread _thread;
+    bool _stop{ false };
 };
 
-class stderr_color_sink_mt : public Sink {
+// file_event_handlers giving the FILE* of a file sink a larger stdio buffer, so the
+// formatted lines reach the kernel in few large writes instead of one per BUFSIZ.
+spd::file_event_handlers buffered_file_handlers(size_t buffer_size)
+{
+    spd::file_event_handlers handlers;
+    if (buffer_size == 0)
+        return handlers;
+    auto buffer = std::make_shared<std::vector<char>>(buffer_size);
+    handlers.after_open = [buffer](const spd::filename_t&, std::FILE* file) {
+        // the handler owns the buffer, which outlives every stream the file_helper opens
+        std::setvbuf(file, buffer->data(), _IOFBF, buffer->size());
+    };
+    return handlers;
+}
+
+#ifndef _WIN32
+// File sink writing formatted records straight into a memory mapped, preallocated segment of
+// segment_size bytes, skipping the stdio buffer copy and write syscalls. A full segment is
+// truncated to its used size and logging continues in base.N.ext, like rotating_file_sink.
+// flush() schedules writeback with msync, or waits for it when sync_on_flush is set.
+// After a crash the last segment may end with zero bytes from the preallocation.
+template <typename Mutex>
+class mmap_sink : public spd::sinks::base_sink<Mutex> {
 public:
-    stderr_color_sink_mt()
+    mmap_sink(const spd::filename_t& filename, size_t segment_size, bool truncate, bool sync_on_flush)
+        : _filename(filename)
+        , _segment_size(segment_size)
+        , _sync_on_flush(sync_on_flush)
+        , _page_size((size_t)sysconf(_SC_PAGESIZE))
     {
-        _sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+        if (segment_size == 0)
+            throw std::invalid_argument("segment_size must be positive");
+        // keep appending to the last segment of a previous run
+        if (!truncate) {
+            while (spd::details::os::path_exists(segment_filename_(_index + 1)))
+                ++_index;
+        }
+        open_segment_(truncate, 0);
     }
-};
 
-class basic_file_sink_st : public Sink {
-public:
-    basic_file_sink_st(const std::string& base_filename, bool truncate)
+    ~mmap_sink() override
     {
-        _sink = std::make_shared<spdlog::sinks::basic_file_sink_st>(base_filename, truncate);
+        close_segment_();
     }
-};
 
-class basic_file_sink_mt : public Sink {
-public:
-    basic_file_sink_mt(const std::string& base_filename, bool truncate)
+    mmap_sink(const mmap_sink&) = delete;
+    mmap_sink& operator=(const mmap_sink&) = delete;
+
+protected:
+    void sink_it_(const spd::details::log_msg& msg) override
     {
-        _sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(base_filename, truncate);
+        spd::memory_buf_t formatted;
+        this->formatter_->format(msg, formatted);
+        // without a map the last roll over failed, the next segment is opened again or this throws
+        if (_map == nullptr || _used + formatted.size() > _map_len) {
+            if (_map != nullptr) {
+                close_segment_();
+                ++_index;
+            }
+            open_segment_(true, formatted.size());
+        }
+        std::memcpy(_map + _used, formatted.data(), formatted.size());
+        _used += formatted.size();
     }
-};
 
-class daily_file_sink_mt : public Sink {
-public:
-    daily_file_sink_mt(const std::string& base_filename, int rotation_hour, int rotation_minute)
+    void flush_() override
     {
-        _sink = std::make_shared<spdlog::sinks::daily_file_sink_mt>(base_filename, rotation_hour, rotation_minute);
+        if (_map == nullptr || _synced == _used)
+            return;
+        size_t from = _synced - _synced % _page_size;
+        if (msync(_map + from, _used - from, _sync_on_flush ? MS_SYNC : MS_ASYNC) != 0)
+            spd::throw_spdlog_ex("msync failed on " + segment_filename_(_index), errno);
+        _synced = _used;
     }
-};
 
-class daily_file_sink_st : public Sink {
-public:
-    daily_file_sink_st(const std::string& base_filename, int rotation_hour, int rotation_minute)
+private:
+    spd::filename_t segment_filename_(size_t index) const
     {
-        _sink = std::make_shared<spdlog::sinks::daily_file_sink_st>(base_filename, rotation_hour, rotation_minute);
+        if (index == 0)
+            return _filename;
+        spd::filename_t basename, ext;
+        std::tie(basename, ext) = spd::details::file_helper::split_by_extension(_filename);
+        return fmt::format("{}.{}{}", basename, index, ext);
     }
-};
 
-class rotating_file_sink_mt : public Sink {
-public:
-    rotating_file_sink_mt(const std::string& filename, size_t max_file_size, size_t max_files)
+    // Maps capacity bytes (at least segment_size) past the current end of the segment file. The
+    // state is only changed once the segment is mapped, on failure the sink stays without a map.
+    void open_segment_(bool truncate, size_t capacity)
     {
-        _sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(filename, max_file_size, max_files);
+        auto filename = segment_filename_(_index);
+        int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+        if (fd < 0)
+            spd::throw_spdlog_ex("Failed opening file " + filename, errno);
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            fail_(fd, "fstat failed on " + filename);
+        // mappings start on a page boundary, the tail of the existing content is mapped again
+        size_t map_offset = (size_t)st.st_size - (size_t)st.st_size % _page_size;
+        size_t used = (size_t)st.st_size - map_offset;
+        size_t map_len = used + std::max(capacity, _segment_size);
+        map_len += (_page_size - map_len % _page_size) % _page_size;
+#ifdef __linux__
+        int err = ::posix_fallocate(fd, (off_t)map_offset, (off_t)map_len);
+        if (err != 0) {
+            errno = err;
+            fail_(fd, "fallocate failed on " + filename);
+        }
+#else
+        if (::ftruncate(fd, (off_t)(map_offset + map_len)) != 0)
+            fail_(fd, "ftruncate failed on " + filename);
+#endif
+        void* map = ::mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)map_offset);
+        if (map == MAP_FAILED)
+            fail_(fd, "mmap failed on " + filename);
+        _fd = fd;
+        _map = static_cast<char*>(map);
+        _map_offset = map_offset;
+        _map_len = map_len;
+        _used = used;
+        _synced = used;
     }
-};
 
-class rotating_file_sink_st : public Sink {
-public:
-    rotating_file_sink_st(const std::string& filename, size_t max_file_size, size_t max_files)
+    // Unmaps the segment and cuts off the unused part of the preallocation.
+    void close_segment_()
     {
-        _sink = std::make_shared<spdlog::sinks::rotating_file_sink_st>(filename, max_file_size, max_files);
+        if (_map != nullptr) {
+            ::munmap(_map, _map_len);
+            _map = nullptr;
+        }
+        if (_fd >= 0) {
+            // on failure the file keeps the zero filled tail, nothing more can be done here
+            int rc = ::ftruncate(_fd, (off_t)(_map_offset + _used));
+            (void)rc;
+            ::close(_fd);
+            _fd = -1;
+        }
     }
-};
 
-class null_sink_st : public Sink {
-public:
-    null_sink_st()
+    [[noreturn]] static void fail_(int fd, const std::string& msg)
     {
-        _sink = std::make_shared<spdlog::sinks::null_sink_st>();
+        int err = errno;
+        ::close(fd);
+        spd::throw_spdlog_ex(msg, err);
     }
+
+    const spd::filename_t _filename;
+    const size_t _segment_size;
+    const bool _sync_on_flush;
+    const size_t _page_size;
+    size_t _index{ 0 };
+    int _fd{ -1 };
+    char* _map{ nullptr };
+    size_t _map_offset{ 0 };
+    size_t _map_len{ 0 };
+    size_t _used{ 0 };
+    size_t _synced{ 0 };
 };
+#endif
 
-class null_sink_mt : public Sink {
-public:
-    null_sink_mt()
+#ifdef SPDLOG_ENABLE_ZLIB
+// Totals of a compressed_rotating_sink, updated by the thread doing the compression.
+struct CompressionStats {
+    std::atomic<uint64_t> files{ 0 };
+    std::atomic<uint64_t> bytes_in{ 0 };
+    std::atomic<uint64_t> bytes_out{ 0 };
+    std::atomic<uint64_t> nanoseconds{ 0 };
+    std::atomic<uint64_t> pending{ 0 };
+
+    void add(uint64_t in, uint64_t out, std::chrono::steady_clock::duration elapsed)
     {
-        _sink = std::make_shared<spdlog::sinks::null_sink_mt>();
+        bytes_in += in;
+        bytes_out += out;
+        nanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
     }
 };
 
-class tcp_sink_st : public Sink {
+// Compresses rolled files of a compressed_rotating_sink and shifts them into base.1.ext.gz,
+// base.2.ext.gz, ... on its own thread. All renames of rolled files happen here, in order.
+class gzip_roller : public fork_thread_owner {
 public:
-    tcp_sink_st(std::string server_host, int server_port, bool lazy_connect)
+    gzip_roller(const spd::filename_t& filename, size_t max_files, int level, std::shared_ptr<CompressionStats> stats)
+        : _max_files(max_files)
+        , _mode(fmt::format("wb{}", level))
+        , _stats(std::move(stats))
     {
-        struct spdlog::sinks::tcp_sink_config tcp_config(server_host, server_port);
-        tcp_config.lazy_connect = lazy_connect;
+        std::tie(_basename, _ext) = spd::details::file_helper::split_by_extension(filename);
+        _thread = std::thread([this] { run_(); });
+        add_thread_owner(this);
+    }
 
-        _sink = std::make_shared<spdlog::sinks::tcp_sink_st>(tcp_config);
+    // Finishes the queued files before returning.
+    ~gzip_roller()
+    {
+        erase_fork_entry(g_thread_owners, static_cast<fork_thread_owner*>(this));
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_one();
+        _thread.join();
     }
-};
 
-class tcp_sink_mt : public Sink {
-public:
-    tcp_sink_mt(std::string server_host, int server_port, bool lazy_connect)
+    // pending was renamed away from the live file, compressed tells if it is gzip already.
+    void add(const spd::filename_t& pending, bool compressed)
     {
-        struct spdlog::sinks::tcp_sink_config tcp_config(server_host, server_port);
-        tcp_config.lazy_connect = lazy_connect;
+        ++_stats->pending;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(job{ pending, compressed });
+        }
+        _cv.notify_one();
+    }
+
+    spd::filename_t rolled_name(size_t index) const
+    {
+        return fmt::format("{}.{}{}.gz", _basename, index, _ext);
+    }
 
-        _sink = std::make_shared<spdlog::sinks::tcp_sink_mt>(tcp_config);
+    std::mutex* fork_mutex() override { return &_mutex; }
+
+    // The files queued at the fork are rolled by the parent.
+    void restart_after_fork() override
+    {
+        abandon_thread(_thread);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.clear();
+        }
+        _stats->pending = 0;
+        _thread = std::thread([this] { run_(); });
     }
-};
 
-#ifdef SPDLOG_ENABLE_SYSLOG
-class syslog_sink_st : public Sink {
-public:
-    syslog_sink_st(const std::string& ident = "", int syslog_option = 0, int syslog_facility = (1 << 3), bool enable_formatting = true)
+private:
+    struct job {
+        spd::filename_t filename;
+        bool compressed;
+    };
+
+    void run_()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+            if (_jobs.empty())
+                return;
+            job next = _jobs.front();
+            _jobs.pop_front();
+            lock.unlock();
+            try {
+                roll_(next);
+            } catch (const std::exception& ex) {
+                std::cerr << "[spdlog] failed compressing " << next.filename << ": " << ex.what() << std::endl;
+            }
+            --_stats->pending;
+            lock.lock();
+        }
+    }
+
+    void roll_(const job& next)
     {
-        _sink = std::make_shared<spdlog::sinks::syslog_sink_st>(ident, syslog_option, syslog_facility, enable_formatting);
+        spd::filename_t compressed = next.filename;
+        if (!next.compressed) {
+            compressed = next.filename + ".gz";
+            compress_(next.filename, compressed);
+            spd::details::os::remove(next.filename);
+        }
+        if (_max_files == 0) {
+            spd::details::os::remove(compressed);
+            return;
+        }
+        spd::details::os::remove_if_exists(rolled_name(_max_files));
+        for (size_t i = _max_files - 1; i > 0; --i) {
+            if (spd::details::os::path_exists(rolled_name(i)))
+                spd::details::os::rename(rolled_name(i), rolled_name(i + 1));
+        }
+        if (spd::details::os::rename(compressed, rolled_name(1)) != 0)
+            spd::throw_spdlog_ex("failed renaming " + compressed, errno);
+    }
+
+    void compress_(const spd::filename_t& source, const spd::filename_t& target)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::FILE* in = std::fopen(source.c_str(), "rb");
+        if (in == nullptr)
+            spd::throw_spdlog_ex("failed opening " + source, errno);
+        gzFile out = gzopen(target.c_str(), _mode.c_str());
+        if (out == nullptr) {
+            std::fclose(in);
+            spd::throw_spdlog_ex("failed opening " + target, errno);
+        }
+        std::vector<char> buf(1 << 16);
+        uint64_t total = 0;
+        size_t n;
+        bool ok = true;
+        while (ok && (n = std::fread(buf.data(), 1, buf.size(), in)) > 0) {
+            ok = gzwrite(out, buf.data(), (unsigned)n) == (int)n;
+            total += n;
+        }
+        std::fclose(in);
+        if (gzclose(out) != Z_OK || !ok)
+            spd::throw_spdlog_ex("failed compressing into " + target);
+        struct stat st;
+        uint64_t written = ::stat(target.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+        _stats->add(total, written, std::chrono::steady_clock::now() - start);
+        ++_stats->files;
     }
+
+    spd::filename_t _basename;
+    spd::filename_t _ext;
+    const size_t _max_files;
+    const std::string _mode;
+    std::shared_ptr<CompressionStats> _stats;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<job> _jobs;
+    bool _stop{ false };
+    std::thread _thread;
 };
 
-class syslog_sink_mt : public Sink {
+// Rotating file sink keeping max_files gzip compressed rolled files. The live file is written
+// uncompressed and compressed by a gzip_roller thread once rolled, so logging never waits for
+// zlib. In streaming mode records are compressed as they arrive into filename.gz instead and
+// flush() emits a sync flush, so the live file can be decompressed up to the last flush.
+template <typename Mutex>
+class compressed_rotating_sink : public spd::sinks::base_sink<Mutex> {
 public:
-    syslog_sink_mt(const std::string& ident = "", int syslog_option = 0, int syslog_facility = (1 << 3), bool enable_formatting = true)
+    compressed_rotating_sink(const spd::filename_t& filename, size_t max_size, size_t max_files, int level, bool streaming)
+        : _filename(streaming ? filename + ".gz" : filename)
+        , _max_size(max_size)
+        , _level(level)
+        , _streaming(streaming)
+        , _stats(std::make_shared<CompressionStats>())
     {
-        _sink = std::make_shared<spdlog::sinks::syslog_sink_mt>(ident, syslog_option, syslog_facility, enable_formatting);
+        if (max_size == 0)
+            throw std::invalid_argument("max_size must be positive");
+        if (level < 1 || level > 9)
+            throw std::invalid_argument("compression level must be between 1 and 9");
+        _roller.reset(new gzip_roller(filename, max_files, level, _stats));
+        std::tie(_basename, _ext) = spd::details::file_helper::split_by_extension(filename);
+        resume_pending_();
+        open_();
     }
-};
-#endif
 
-class Logger {
-public:
-    using async_factory_nb = spdlog::async_factory_impl<spdlog::async_overflow_policy::overrun_oldest>;
+    ~compressed_rotating_sink() override
+    {
+        close_();
+        _roller.reset();
+    }
+
+    std::shared_ptr<CompressionStats> stats() const { return _stats; }
+
+protected:
+    void sink_it_(const spd::details::log_msg& msg) override
+    {
+        spd::memory_buf_t formatted;
+        this->formatter_->format(msg, formatted);
+        if (_size > 0 && _size + formatted.size() > _max_size)
+            rotate_();
+        if (_streaming) {
+            auto start = std::chrono::steady_clock::now();
+            if (gzwrite(_gz, formatted.data(), (unsigned)formatted.size()) != (int)formatted.size())
+                spd::throw_spdlog_ex("failed writing to " + _filename);
+            _compress_time += std::chrono::steady_clock::now() - start;
+        } else {
+            _file.write(formatted);
+        }
+        _size += formatted.size();
+    }
+
+    void flush_() override
+    {
+        if (_streaming)
+            gzflush(_gz, Z_SYNC_FLUSH);
+        else
+            _file.flush();
+    }
+
+private:
+    void open_()
+    {
+        if (_streaming) {
+            // appending starts a new gzip member, which gunzip reads as one stream. The
+            // uncompressed size of a previous run is unknown, it is not counted towards max_size.
+            _gz = gzopen(_filename.c_str(), fmt::format("ab{}", _level).c_str());
+            if (_gz == nullptr)
+                spd::throw_spdlog_ex("Failed opening file " + _filename, errno);
+            _size = 0;
+            _compress_time = std::chrono::steady_clock::duration::zero();
+        } else {
+            _file.open(_filename, false);
+            _size = _file.size();
+        }
+    }
+
+    void close_()
+    {
+        if (_streaming) {
+            // the totals cover finished files, the compressed size is only known after gzclose
+            if (_gz != nullptr) {
+                gzclose(_gz);
+                _gz = nullptr;
+                struct stat st;
+                if (_size > 0 && ::stat(_filename.c_str(), &st) == 0) {
+                    _stats->add(_size, (uint64_t)st.st_size, _compress_time);
+                    ++_stats->files;
+                }
+            }
+        } else {
+            _file.close();
+        }
+    }
+
+    // Hands the files a previous process rolled but did not get to compress to the roller, oldest
+    // first, and numbers the next ones after them so they are not overwritten. An uncompressed
+    // file wins over a .gz next to it, which is a compression cut short.
+    void resume_pending_()
+    {
+        auto slash = _basename.rfind('/');
+        spd::filename_t dirname = slash == spd::filename_t::npos ? "." : _basename.substr(0, slash + 1);
+        spd::filename_t prefix = (slash == spd::filename_t::npos ? _basename : _basename.substr(slash + 1)) + ".rolling";
+        DIR* dir = ::opendir(dirname.c_str());
+        if (dir == nullptr)
+            return;
+        // index -> (uncompressed file found, compressed file found)
+        std::map<size_t, std::pair<bool, bool>> pending;
+        while (struct dirent* entry = ::readdir(dir)) {
+            spd::filename_t name(entry->d_name);
+            if (name.compare(0, prefix.size(), prefix) != 0)
+                continue;
+            size_t digits = prefix.size();
+            while (digits < name.size() && name[digits] >= '0' && name[digits] <= '9')
+                ++digits;
+            if (digits == prefix.size() || digits - prefix.size() > 18)
+                continue;
+            spd::filename_t suffix = name.substr(digits);
+            bool compressed = suffix == _ext + ".gz";
+            if (!compressed && (_streaming || suffix != _ext))
+                continue;
+            auto& found = pending[std::stoull(name.substr(prefix.size(), digits - prefix.size()))];
+            (compressed ? found.second : found.first) = true;
+        }
+        ::closedir(dir);
+        for (const auto& entry : pending) {
+            auto name = fmt::format("{}.rolling{}{}", _basename, entry.first, _ext);
+            if (entry.second.first) {
+                spd::details::os::remove_if_exists(name + ".gz");
+                _roller->add(name, false);
+            } else {
+                _roller->add(name + ".gz", true);
+            }
+            _rolled = entry.first + 1;
+        }
+    }
+
+    // Moves the live file out of the way and hands it to the roller.
+    void rotate_()
+    {
+        close_();
+        auto pending = fmt::format("{}.rolling{}{}{}", _basename, _rolled++, _ext, _streaming ? ".gz" : "");
+        if (spd::details::os::rename(_filename, pending) != 0) {
+            open_();
+            spd::throw_spdlog_ex("failed renaming " + _filename + " to " + pending, errno);
+        }
+        _roller->add(pending, _streaming);
+        open_();
+    }
+
+    const spd::filename_t _filename;
+    spd::filename_t _basename;
+    spd::filename_t _ext;
+    const size_t _max_size;
+    const int _level;
+    const bool _streaming;
+    std::shared_ptr<CompressionStats> _stats;
+    std::unique_ptr<gzip_roller> _roller;
+    spd::details::file_helper _file;
+    gzFile _gz{ nullptr };
+    std::chrono::steady_clock::duration _compress_time{};
+    size_t _size{ 0 };
+    size_t _rolled{ 0 };
+};
+#endif
+
+// Compact binary log format written by binary_sink and read back by binary_log_reader.
+// The file is a sequence of chunks, each opened by binary_log::magic, which resets the
+// interned names and the timestamp base. A chunk holds tagged entries:
+//   name:   tag_name, varint id, varint size, bytes
+//   record: tag_record, zigzag varint nanoseconds since the previous record, level byte,
+//           varint thread id, varint name id, varint size, payload bytes
+namespace binary_log {
+    const char magic[] = { 'S', 'P', 'D', 'B', 1 };
+    const unsigned char tag_name = 1;
+    const unsigned char tag_record = 2;
+
+    inline void put_varint(spd::memory_buf_t& buf, uint64_t value)
+    {
+        while (value >= 0x80) {
+            buf.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        buf.push_back((char)value);
+    }
+
+    inline uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    inline int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+}
+
+// Writes records in the binary_log format, skipping pattern formatting altogether.
+template <typename Mutex>
+class binary_sink : public spd::sinks::base_sink<Mutex> {
+public:
+    binary_sink(const spd::filename_t& filename, bool truncate)
+    {
+        _file.open(filename, truncate);
+        spd::memory_buf_t buf;
+        buf.append(binary_log::magic, binary_log::magic + sizeof(binary_log::magic));
+        _file.write(buf);
+    }
+
+protected:
+    void sink_it_(const spd::details::log_msg& msg) override
+    {
+        _buf.clear();
+        uint64_t name_id = intern_(msg.logger_name);
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(msg.time.time_since_epoch()).count();
+        _buf.push_back((char)binary_log::tag_record);
+        binary_log::put_varint(_buf, binary_log::zigzag(time - _last_time));
+        _buf.push_back((char)msg.level);
+        binary_log::put_varint(_buf, msg.thread_id);
+        binary_log::put_varint(_buf, name_id);
+        binary_log::put_varint(_buf, msg.payload.size());
+        _buf.append(msg.payload.data(), msg.payload.data() + msg.payload.size());
+        _file.write(_buf);
+        _last_time = time;
+    }
+
+    void flush_() override
+    {
+        _file.flush();
+    }
+
+private:
+    // Returns the id of name, writing its definition into _buf the first time it is seen.
+    uint64_t intern_(spd::string_view_t name)
+    {
+        if (_last_id != 0 && name.size() == _last_name.size() && std::equal(name.data(), name.data() + name.size(), _last_name.data()))
+            return _last_id;
+        _last_name.assign(name.data(), name.size());
+        auto it = _names.find(_last_name);
+        if (it == _names.end()) {
+            it = _names.emplace(_last_name, _names.size() + 1).first;
+            _buf.push_back((char)binary_log::tag_name);
+            binary_log::put_varint(_buf, it->second);
+            binary_log::put_varint(_buf, name.size());
+            _buf.append(name.data(), name.data() + name.size());
+        }
+        _last_id = it->second;
+        return _last_id;
+    }
+
+    spd::details::file_helper _file;
+    spd::memory_buf_t _buf;
+    std::unordered_map<std::string, uint64_t> _names;
+    std::string _last_name;
+    uint64_t _last_id{ 0 };
+    int64_t _last_time{ 0 };
+};
+
+// Streams records back from a binary_sink file. A record whose header was cut short at the end of
+// the file, as left behind by a crash, ends the stream. A size reaching past the end of the file
+// can not be told from a corrupt one and raises ValueError.
+class binary_log_reader {
+public:
+    struct record {
+        spd::level::level_enum level;
+        spd::log_clock::time_point time;
+        size_t thread_id;
+        const std::string* logger_name;
+        spd::string_view_t payload;
+    };
+
+    explicit binary_log_reader(const std::string& filename)
+        : _filename(filename)
+        , _buf(1 << 20)
+    {
+        _file = std::fopen(filename.c_str(), "rb");
+        if (_file == nullptr)
+            spd::throw_spdlog_ex("Failed opening file " + filename + " for reading", errno);
+        _size = spd::details::os::filesize(_file);
+    }
+    ~binary_log_reader()
+    {
+        std::fclose(_file);
+    }
+    binary_log_reader(const binary_log_reader&) = delete;
+    binary_log_reader& operator=(const binary_log_reader&) = delete;
+
+    // The payload and name of r stay valid until the next call.
+    bool next(record& r)
+    {
+        for (;;) {
+            if (_eof || !fill_(1))
+                return false;
+            unsigned char tag = (unsigned char)_buf[_pos];
+            if (tag == (unsigned char)binary_log::magic[0]) {
+                if (!fill_(sizeof(binary_log::magic)))
+                    return false;
+                if (!std::equal(binary_log::magic, binary_log::magic + sizeof(binary_log::magic), _buf.data() + _pos))
+                    corrupt_();
+                _pos += sizeof(binary_log::magic);
+                _names.clear();
+                _last_time = 0;
+            } else if (tag == binary_log::tag_name) {
+                ++_pos;
+                uint64_t id, size;
+                if (!varint_(id) || !length_(size) || !fill_(size))
+                    return false;
+                _names[id].assign(_buf.data() + _pos, size);
+                _pos += size;
+            } else if (tag == binary_log::tag_record) {
+                ++_pos;
+                uint64_t delta, thread_id, name_id, size;
+                if (!varint_(delta) || !fill_(1))
+                    return false;
+                unsigned char level = (unsigned char)_buf[_pos++];
+                if (!varint_(thread_id) || !varint_(name_id) || !length_(size) || !fill_(size))
+                    return false;
+                auto name = _names.find(name_id);
+                if (name == _names.end() || level >= spd::level::n_levels)
+                    corrupt_();
+                _last_time += binary_log::unzigzag(delta);
+                r.level = (spd::level::level_enum)level;
+                r.time = spd::log_clock::time_point(std::chrono::duration_cast<spd::log_clock::duration>(std::chrono::nanoseconds(_last_time)));
+                r.thread_id = (size_t)thread_id;
+                r.logger_name = &name->second;
+                r.payload = spd::string_view_t(_buf.data() + _pos, size);
+                _pos += size;
+                return true;
+            } else {
+                corrupt_();
+            }
+        }
+    }
+
+private:
+    // Makes n bytes available at _pos, false once the end of the file is reached. Moving the
+    // unread bytes to the front invalidates the views of earlier records.
+    bool fill_(size_t n)
+    {
+        if (_end - _pos >= n)
+            return true;
+        if (_eof)
+            return false;
+        std::memmove(_buf.data(), _buf.data() + _pos, _end - _pos);
+        _offset += _pos;
+        _end -= _pos;
+        _pos = 0;
+        if (_buf.size() < n)
+            _buf.resize(std::max(n, _buf.size() * 2));
+        while (_end < n) {
+            size_t read = std::fread(_buf.data() + _end, 1, _buf.size() - _end, _file);
+            if (read == 0) {
+                _eof = true;
+                return false;
+            }
+            _end += read;
+        }
+        return true;
+    }
+
+    bool varint_(uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!fill_(1))
+                return false;
+            unsigned char byte = (unsigned char)_buf[_pos++];
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        corrupt_();
+    }
+
+    // Reads the size of a name or payload. A corrupt one must not make fill_ allocate it, sizes
+    // past the end of the file or above max_entry_size are corrupt.
+    bool length_(uint64_t& size)
+    {
+        if (!varint_(size))
+            return false;
+        if (size > max_entry_size)
+            corrupt_(fmt::format("entry of {} bytes is too large", size));
+        // The file may have grown since its size was taken, refresh it only when an entry
+        // seems to go past the end.
+        if (size > remaining_()) {
+            _size = spd::details::os::filesize(_file);
+            if (size > remaining_())
+                corrupt_(fmt::format("entry of {} bytes goes past the end of the file", size));
+        }
+        return true;
+    }
+
+    // Bytes of the file after _pos, as of the last time its size was taken.
+    uint64_t remaining_() const
+    {
+        return _size > _offset + _pos ? _size - (_offset + _pos) : 0;
+    }
+
+    static const uint64_t max_entry_size = (uint64_t)1 << 30;
+
+    // Every kind of corrupt input raises ValueError.
+    [[noreturn]] void corrupt_(const std::string& what = "unexpected data")
+    {
+        throw std::invalid_argument(fmt::format("corrupt binary log {} at offset {}: {}", _filename, _offset + _pos, what));
+    }
+
+    const std::string _filename;
+    std::FILE* _file;
+    std::vector<char> _buf;
+    size_t _pos{ 0 };
+    size_t _end{ 0 };
+    size_t _offset{ 0 };
+    uint64_t _size{ 0 };
+    bool _eof{ false };
+    std::unordered_map<uint64_t, std::string> _names;
+    int64_t _last_time{ 0 };
+};
+
+// (level, time, thread_id, logger_name, payload) tuple handed to Python sinks and returned by BinaryLogReader.
+py::tuple record_tuple(spd::level::level_enum level, spd::log_clock::time_point time, size_t thread_id, const std::string& logger_name, spd::string_view_t payload)
+{
+    auto text = py::reinterpret_steal<py::object>(PyUnicode_DecodeUTF8(payload.data(), (Py_ssize_t)payload.size(), "replace"));
+    if (!text)
+        throw py::error_already_set();
+    return py::make_tuple((int)level, std::chrono::duration<double>(time.time_since_epoch()).count(), thread_id, py::str(logger_name), text);
+}
+
+#ifndef _WIN32
+// Multi-producer, single consumer ring of log records in POSIX shared memory, shared by every
+// process logging through a shared_memory_sink and drained by a SharedMemoryCollector.
+// Producers reserve space with a CAS on head and publish an entry by storing its size into
+// the entry's first word. The collector zeroes consumed entries before moving tail past them,
+// so a zero word means "not yet published". Entries never wrap, a padding entry fills the
+// end of the ring instead. A producer killed between reserving and publishing an entry
+// stalls the collector at that entry.
+class shm_ring {
+public:
+    struct header {
+        uint64_t magic;
+        uint64_t capacity;
+        uint64_t collector_pid;
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) std::atomic<uint64_t> dropped;
+    };
+
+    struct record {
+        int64_t time_ns;
+        uint64_t thread_id;
+        uint32_t payload_size;
+        uint8_t level;
+        uint8_t name_size;
+    };
+
+    static const uint64_t magic_value = 0x53504452494e4732ULL; // "SPDRING2"
+    static const uint64_t padding_flag = 1ULL << 63;
+
+    // The collector creates the ring, sinks attach to an existing one. A ring left behind by a
+    // collector that died is replaced, any existing one when force is set.
+    shm_ring(const std::string& name, size_t capacity, bool create, bool force = false)
+        : _name(name.empty() || name[0] != '/' ? "/" + name : name)
+        , _owner(create)
+    {
+        if (create && (capacity < 4096 || (capacity & (capacity - 1)) != 0))
+            throw std::invalid_argument("capacity must be a power of two of at least 4096");
+        int fd = ::shm_open(_name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+        if (fd < 0 && create && errno == EEXIST && (force || stale_(_name))) {
+            ::shm_unlink(_name.c_str());
+            fd = ::shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        if (fd < 0 && create && errno == EEXIST)
+            spd::throw_spdlog_ex("Shared memory " + _name + " is in use by a running collector, pass force=True to replace it");
+        if (fd < 0)
+            spd::throw_spdlog_ex(create ? "Failed creating shared memory " + _name : "Failed opening shared memory " + _name + ", is a collector running?", errno);
+        if (create) {
+            _size = data_offset() + capacity;
+            if (::ftruncate(fd, (off_t)_size) != 0) {
+                int err = errno;
+                ::close(fd);
+                ::shm_unlink(_name.c_str());
+                spd::throw_spdlog_ex("Failed sizing shared memory " + _name, err);
+            }
+        } else {
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || (size_t)st.st_size < data_offset()) {
+                ::close(fd);
+                spd::throw_spdlog_ex("Shared memory " + _name + " is not a log ring");
+            }
+            _size = (size_t)st.st_size;
+        }
+        void* map = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            if (create)
+                ::shm_unlink(_name.c_str());
+            spd::throw_spdlog_ex("Failed mapping shared memory " + _name, err);
+        }
+        _header = static_cast<header*>(map);
+        _data = static_cast<char*>(map) + data_offset();
+        if (create) {
+            // the new object is zero filled, which also marks every entry unpublished
+            new (&_header->head) std::atomic<uint64_t>(0);
+            new (&_header->tail) std::atomic<uint64_t>(0);
+            new (&_header->dropped) std::atomic<uint64_t>(0);
+            _header->capacity = capacity;
+            _header->collector_pid = (uint64_t)::getpid();
+            std::atomic_thread_fence(std::memory_order_release);
+            _header->magic = magic_value;
+        } else if (_header->magic != magic_value || data_offset() + _header->capacity != _size) {
+            ::munmap(map, _size);
+            spd::throw_spdlog_ex("Shared memory " + _name + " is not a log ring");
+        }
+        if (!_header->head.is_lock_free())
+            throw std::runtime_error("shared memory rings need lock free 64 bit atomics");
+    }
+
+    ~shm_ring()
+    {
+        ::munmap(_header, _size);
+        if (_owner)
+            ::shm_unlink(_name.c_str());
+    }
+
+    // In a forked child: the ring stays the parent's, it is not unlinked from here.
+    void disown() { _owner = false; }
+
+    shm_ring(const shm_ring&) = delete;
+    shm_ring& operator=(const shm_ring&) = delete;
+
+    uint64_t capacity() const { return _header->capacity; }
+    uint64_t dropped() const { return _header->dropped.load(std::memory_order_relaxed); }
+
+    // Publishes one record, returns false when the ring is full and block is not set.
+    bool push(const spd::details::log_msg& msg, bool block)
+    {
+        size_t name_size = std::min<size_t>(msg.logger_name.size(), 255);
+        // a record may take a quarter of the ring at most, longer payloads are cut
+        size_t max_payload = (size_t)capacity() / 4 - sizeof(std::atomic<uint64_t>) - sizeof(record) - name_size;
+        size_t payload_size = std::min(msg.payload.size(), max_payload);
+        uint64_t size = align_(sizeof(std::atomic<uint64_t>) + sizeof(record) + name_size + payload_size);
+
+        const uint64_t mask = capacity() - 1;
+        uint64_t head = _header->head.load(std::memory_order_relaxed);
+        uint64_t start, padding;
+        for (unsigned spins = 0;; ++spins) {
+            start = head;
+            padding = 0;
+            if ((start & mask) + size > capacity()) {
+                padding = capacity() - (start & mask);
+                start += padding;
+            }
+            if (start + size - _header->tail.load(std::memory_order_acquire) > capacity()) {
+                if (!block) {
+                    _header->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                backoff_(spins);
+                head = _header->head.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (_header->head.compare_exchange_weak(head, start + size, std::memory_order_relaxed))
+                break;
+        }
+        if (padding > 0)
+            state_(start - padding).store(padding | padding_flag, std::memory_order_release);
+
+        char* entry = _data + (start & mask);
+        record r;
+        r.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(msg.time.time_since_epoch()).count();
+        r.thread_id = msg.thread_id;
+        r.payload_size = (uint32_t)payload_size;
+        r.level = (uint8_t)msg.level;
+        r.name_size = (uint8_t)name_size;
+        char* body = entry + sizeof(std::atomic<uint64_t>);
+        std::memcpy(body, &r, sizeof(r));
+        std::memcpy(body + sizeof(r), msg.logger_name.data(), name_size);
+        std::memcpy(body + sizeof(r) + name_size, msg.payload.data(), payload_size);
+        state_(start).store(size, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: calls f(log_msg) for every published record in order, returns their number.
+    template <typename F>
+    size_t drain(F&& f)
+    {
+        const uint64_t mask = capacity() - 1;
+        uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+        size_t count = 0;
+        for (;;) {
+            uint64_t state = state_(tail).load(std::memory_order_acquire);
+            if (state == 0)
+                break;
+            uint64_t size = state & ~padding_flag;
+            char* entry = _data + (tail & mask);
+            if ((state & padding_flag) == 0) {
+                record r;
+                const char* body = entry + sizeof(std::atomic<uint64_t>);
+                std::memcpy(&r, body, sizeof(r));
+                auto time = spd::log_clock::time_point(std::chrono::duration_cast<spd::log_clock::duration>(std::chrono::nanoseconds(r.time_ns)));
+                spd::details::log_msg msg(time, spd::source_loc{}, spd::string_view_t(body + sizeof(r), r.name_size),
+                    (spd::level::level_enum)r.level, spd::string_view_t(body + sizeof(r) + r.name_size, r.payload_size));
+                msg.thread_id = (size_t)r.thread_id;
+                f(msg);
+                ++count;
+            }
+            std::memset(entry + sizeof(std::atomic<uint64_t>), 0, (size_t)size - sizeof(std::atomic<uint64_t>));
+            state_(tail).store(0, std::memory_order_relaxed);
+            tail += size;
+            _header->tail.store(tail, std::memory_order_release);
+        }
+        return count;
+    }
+
+private:
+    // True for a ring whose collector process no longer exists.
+    static bool stale_(const std::string& name)
+    {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void* map = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header))
+            map = ::mmap(nullptr, sizeof(header), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            return false;
+        const header* h = static_cast<const header*>(map);
+        bool stale = h->magic == magic_value && ::kill((pid_t)h->collector_pid, 0) != 0 && errno == ESRCH;
+        ::munmap(map, sizeof(header));
+        return stale;
+    }
+
+    static size_t data_offset() { return (sizeof(header) + 63) & ~(size_t)63; }
+    static uint64_t align_(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+    std::atomic<uint64_t>& state_(uint64_t position)
+    {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(_data + (position & (capacity() - 1)));
+    }
+
+    static void backoff_(unsigned spins)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    const std::string _name;
+    bool _owner;
+    size_t _size{ 0 };
+    header* _header{ nullptr };
+    char* _data{ nullptr };
+};
+
+// Producer side of a shm_ring. Records are shipped unformatted, the sinks of the collector
+// format them. Lock free, the same sink can be used from any number of threads.
+class shared_memory_sink : public spd::sinks::sink {
+public:
+    shared_memory_sink(const std::string& name, spd::async_overflow_policy policy)
+        : _ring(name, 0, false)
+        , _block(policy == spd::async_overflow_policy::block)
+    {
+    }
+
+    void log(const spd::details::log_msg& msg) override
+    {
+        _ring.push(msg, _block);
+    }
+    void flush() override {}
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spd::formatter>) override {}
+
+private:
+    shm_ring _ring;
+    const bool _block;
+};
+#endif
+
+// Structured records carry their message and fields as a logfmt line in the payload,
+// msg="..." key=value ..., tagged through a source location with line 0 (which no pattern
+// flag prints). Strings are quoted with JSON escaping and other values are JSON literals,
+// so json_formatter copies them into objects without converting them again.
+namespace structured {
+
+    const char record_tag[] = "structured";
+
+    inline spd::source_loc tag() { return spd::source_loc(nullptr, 0, record_tag); }
+
+    inline bool is_structured(const spd::details::log_msg& msg)
+    {
+        return msg.source.line == 0 && msg.source.funcname == record_tag;
+    }
+
+    void append_quoted(spd::string_view_t text, spd::memory_buf_t& dest)
+    {
+        static const char hex[] = "0123456789abcdef";
+        dest.push_back('"');
+        const char* begin = text.data();
+        const char* end = begin + text.size();
+        for (const char* p = begin; p != end; ++p) {
+            const unsigned char c = (unsigned char)*p;
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            dest.append(begin, p);
+            begin = p + 1;
+            dest.push_back('\\');
+            switch (c) {
+            case '"': dest.push_back('"'); break;
+            case '\\': dest.push_back('\\'); break;
+            case '\n': dest.push_back('n'); break;
+            case '\r': dest.push_back('r'); break;
+            case '\t': dest.push_back('t'); break;
+            default: {
+                const char escape[] = { 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                dest.append(escape, escape + sizeof(escape));
+            }
+            }
+        }
+        dest.append(begin, end);
+        dest.push_back('"');
+    }
+
+    // None, bool, int and float become JSON literals, everything else a quoted string.
+    void append_value(py::handle value, spd::memory_buf_t& dest)
+    {
+        PyObject* o = value.ptr();
+        if (o == Py_None) {
+            dest.append(spd::string_view_t("null"));
+        } else if (PyBool_Check(o)) {
+            dest.append(spd::string_view_t(o == Py_True ? "true" : "false"));
+        } else if (PyLong_Check(o)) {
+            int overflow = 0;
+            long long number = PyLong_AsLongLongAndOverflow(o, &overflow);
+            if (overflow == 0)
+                fmt::format_to(fmt::appender(dest), "{}", number);
+            else
+                dest.append(MessageView(value).view());
+        } else if (PyFloat_Check(o)) {
+            double number = PyFloat_AS_DOUBLE(o);
+            if (std::isfinite(number))
+                fmt::format_to(fmt::appender(dest), "{}", number);
+            else
+                append_quoted(MessageView(value).view(), dest);
+        } else {
+            append_quoted(MessageView(value).view(), dest);
+        }
+    }
+
+    void append_key(py::handle key, spd::memory_buf_t& dest)
+    {
+        if (!PyUnicode_Check(key.ptr()))
+            throw std::invalid_argument("field names must be str");
+        auto name = MessageView(key).view();
+        if (name.size() == 0)
+            throw std::invalid_argument("field names must not be empty");
+        for (char c : name)
+            if ((unsigned char)c <= 0x20 || c == '=' || c == '"' || c == '\\')
+                throw std::invalid_argument("field names must not contain spaces, control characters, '=', '\"' or '\\'");
+        dest.append(name);
+    }
+
+    void append_fields(const py::dict& fields, spd::memory_buf_t& dest)
+    {
+        for (auto item : fields) {
+            dest.push_back(' ');
+            append_key(item.first, dest);
+            dest.push_back('=');
+            append_value(item.second, dest);
+        }
+    }
+
+    void append_message(spd::string_view_t message, spd::memory_buf_t& dest)
+    {
+        dest.append(spd::string_view_t("msg="));
+        append_quoted(message, dest);
+    }
+
+    // Reverses append_quoted, value includes the quotes.
+    void append_unquoted(spd::string_view_t value, spd::memory_buf_t& dest)
+    {
+        if (value.size() < 2 || value.data()[0] != '"') {
+            dest.append(value);
+            return;
+        }
+        const char* p = value.data() + 1;
+        const char* end = value.data() + value.size() - 1;
+        while (p != end) {
+            const char* escape = std::find(p, end, '\\');
+            dest.append(p, escape);
+            if (escape == end || escape + 1 == end)
+                break;
+            p = escape + 2;
+            switch (escape[1]) {
+            case 'n': dest.push_back('\n'); break;
+            case 'r': dest.push_back('\r'); break;
+            case 't': dest.push_back('\t'); break;
+            case 'u':
+                if (end - p >= 4) {
+                    dest.push_back((char)std::strtol(std::string(p, p + 4).c_str(), nullptr, 16));
+                    p += 4;
+                }
+                break;
+            default: dest.push_back(escape[1]);
+            }
+        }
+    }
+
+    // Splits the next key=value pair off a structured payload, false at the end.
+    bool next_field(spd::string_view_t& rest, spd::string_view_t& key, spd::string_view_t& value)
+    {
+        const char* p = rest.data();
+        const char* end = p + rest.size();
+        while (p != end && *p == ' ')
+            ++p;
+        const char* key_begin = p;
+        while (p != end && *p != '=')
+            ++p;
+        if (p == end)
+            return false;
+        key = spd::string_view_t(key_begin, (size_t)(p - key_begin));
+        const char* value_begin = ++p;
+        if (p != end && *p == '"') {
+            for (++p; p != end && *p != '"'; ++p)
+                if (*p == '\\' && p + 1 != end)
+                    ++p;
+            if (p != end)
+                ++p;
+        } else {
+            while (p != end && *p != ' ')
+                ++p;
+        }
+        value = spd::string_view_t(value_begin, (size_t)(p - value_begin));
+        rest = spd::string_view_t(p, (size_t)(end - p));
+        return true;
+    }
+
+    // Appends text with the padding and truncation of a flag, like spdlog's own flags for e.g.
+    // %-20v or %20!v. Returns where text starts in dest.
+    inline size_t append_padded(spd::string_view_t text, const spd::details::padding_info& padinfo, spd::memory_buf_t& dest)
+    {
+        if (!padinfo.enabled()) {
+            const size_t start = dest.size();
+            dest.append(text);
+            return start;
+        }
+        spd::details::scoped_padder padder(text.size(), padinfo, dest);
+        const size_t start = dest.size();
+        dest.append(text);
+        return start;
+    }
+
+    // %v of the pattern formatters made here: the message of a structured record without its fields
+    class message_flag : public spd::custom_flag_formatter {
+    public:
+        void format(const spd::details::log_msg& msg, const std::tm&, spd::memory_buf_t& dest) override
+        {
+            spd::string_view_t rest = msg.payload, key, value;
+            if (!is_structured(msg) || !next_field(rest, key, value)) {
+                append_padded(msg.payload, padinfo_, dest);
+            } else if (!padinfo_.enabled()) {
+                append_unquoted(value, dest);
+            } else {
+                spd::memory_buf_t message;
+                append_unquoted(value, message);
+                append_padded(spd::string_view_t(message.data(), message.size()), padinfo_, dest);
+            }
+        }
+        std::unique_ptr<spd::custom_flag_formatter> clone() const override
+        {
+            return spd::details::make_unique<message_flag>();
+        }
+    };
+
+    // %*: the fields of a structured record as key=value pairs, nothing for other records
+    class fields_flag : public spd::custom_flag_formatter {
+    public:
+        void format(const spd::details::log_msg& msg, const std::tm&, spd::memory_buf_t& dest) override
+        {
+            spd::string_view_t rest = msg.payload, key, value;
+            if (!is_structured(msg) || !next_field(rest, key, value))
+                rest = spd::string_view_t();
+            while (rest.size() > 0 && rest.data()[0] == ' ')
+                rest = spd::string_view_t(rest.data() + 1, rest.size() - 1);
+            append_padded(rest, padinfo_, dest);
+        }
+        std::unique_ptr<spd::custom_flag_formatter> clone() const override
+        {
+            return spd::details::make_unique<fields_flag>();
+        }
+    };
+
+    // %+: spdlog's default format, structured records shown as their message followed by the fields
+    class full_flag : public spd::custom_flag_formatter {
+    public:
+        void format(const spd::details::log_msg& msg, const std::tm& tm_time, spd::memory_buf_t& dest) override
+        {
+            if (!padinfo_.enabled()) {
+                format_(msg, tm_time, dest);
+                return;
+            }
+            spd::memory_buf_t line;
+            format_(msg, tm_time, line);
+            const size_t start = append_padded(spd::string_view_t(line.data(), line.size()), padinfo_, dest);
+            // the colored level is moved by the padding, or cut by the truncation
+            msg.color_range_start = std::min(start + msg.color_range_start, dest.size());
+            msg.color_range_end = std::min(start + msg.color_range_end, dest.size());
+        }
+        std::unique_ptr<spd::custom_flag_formatter> clone() const override
+        {
+            return spd::details::make_unique<full_flag>();
+        }
+
+    private:
+        void format_(const spd::details::log_msg& msg, const std::tm& tm_time, spd::memory_buf_t& dest)
+        {
+            if (!is_structured(msg)) {
+                _full.format(msg, tm_time, dest);
+                return;
+            }
+            spd::memory_buf_t payload;
+            _message.format(msg, tm_time, payload);
+            size_t message_size = payload.size();
+            payload.push_back(' ');
+            _fields.format(msg, tm_time, payload);
+            if (payload.size() == message_size + 1)
+                payload.resize(message_size);
+            spd::details::log_msg plain(msg);
+            plain.payload = spd::string_view_t(payload.data(), payload.size());
+            plain.source = spd::source_loc{};
+            _full.format(plain, tm_time, dest);
+            msg.color_range_start = plain.color_range_start;
+            msg.color_range_end = plain.color_range_end;
+        }
+
+        // padded as a whole by format
+        spd::details::full_formatter _full{ spd::details::padding_info{} };
+        message_flag _message;
+        fields_flag _fields;
+    };
+
+    // Pattern formatter where %v is the message and %* the fields of structured records, and %+
+    // shows both. Installed as the default formatter of every sink and logger.
+    std::unique_ptr<spd::formatter> make_pattern_formatter(const std::string& pattern, spd::pattern_time_type type = spd::pattern_time_type::local)
+    {
+        spd::pattern_formatter::custom_flags flags;
+        flags['v'] = spd::details::make_unique<message_flag>();
+        flags['*'] = spd::details::make_unique<fields_flag>();
+        flags['+'] = spd::details::make_unique<full_flag>();
+        auto formatter = spd::details::make_unique<spd::pattern_formatter>(pattern, type, spd::details::os::default_eol, std::move(flags));
+        // custom flags do not ask for the local time, %+ prints it
+        if (pattern.find('+') != std::string::npos)
+            formatter->need_localtime();
+        return std::move(formatter);
+    }
+
+} // namespace structured
+
+// Fields bound with bind_context, serialized once as " key=value ..." and appended to every
+// record logged in the context they were bound in. Stored in a contextvars.ContextVar, so
+// they follow threads and asyncio tasks.
+struct bound_context {
+    py::dict fields;
+    std::string fragment;
+};
+
+// contextvars and their C API exist from Python 3.7, records carry no bound fields before.
+#if PY_VERSION_HEX >= 0x03070000
+PyObject* g_context_var = nullptr;
+const char g_context_capsule[] = "spdlog.bound_context";
+
+// Fields bound in the calling context, null when there are none. holder keeps them alive.
+const bound_context* current_context(py::object& holder)
+{
+    PyObject* value = nullptr;
+    if (PyContextVar_Get(g_context_var, nullptr, &value) < 0)
+        throw py::error_already_set();
+    holder = py::reinterpret_steal<py::object>(value);
+    if (value == nullptr || value == Py_None)
+        return nullptr;
+    return static_cast<const bound_context*>(PyCapsule_GetPointer(value, g_context_capsule));
+}
+
+// Binds fields on top of the current ones, returns the contextvars token restoring them.
+py::object bind_context(const py::dict& fields)
+{
+    py::object holder;
+    const bound_context* current = current_context(holder);
+    std::unique_ptr<bound_context> bound(new bound_context());
+    if (current)
+        bound->fields = py::dict(current->fields);
+    for (auto item : fields)
+        bound->fields[item.first] = item.second;
+    spd::memory_buf_t buf;
+    structured::append_fields(bound->fields, buf);
+    bound->fragment.assign(buf.data(), buf.size());
+    PyObject* capsule = PyCapsule_New(bound.get(), g_context_capsule, [](PyObject* o) {
+        delete static_cast<bound_context*>(PyCapsule_GetPointer(o, g_context_capsule));
+    });
+    if (capsule == nullptr)
+        throw py::error_already_set();
+    bound.release();
+    auto value = py::reinterpret_steal<py::object>(capsule);
+    PyObject* token = PyContextVar_Set(g_context_var, value.ptr());
+    if (token == nullptr)
+        throw py::error_already_set();
+    return py::reinterpret_steal<py::object>(token);
+}
+
+void reset_context(py::object token)
+{
+    if (PyContextVar_Reset(g_context_var, token.ptr()) < 0)
+        throw py::error_already_set();
+}
+
+py::object clear_context()
+{
+    PyObject* token = PyContextVar_Set(g_context_var, Py_None);
+    if (token == nullptr)
+        throw py::error_already_set();
+    return py::reinterpret_steal<py::object>(token);
+}
+
+py::dict get_context()
+{
+    py::object holder;
+    const bound_context* current = current_context(holder);
+    return current ? py::dict(current->fields) : py::dict();
+}
+
+// with spdlog.log_context(request_id=...): binds the fields for the duration of the block.
+class LogContext {
+public:
+    explicit LogContext(py::dict fields)
+        : _fields(std::move(fields))
+    {
+    }
+    LogContext& enter()
+    {
+        _tokens.push_back(bind_context(_fields));
+        return *this;
+    }
+    void exit(py::args)
+    {
+        if (_tokens.empty())
+            throw std::runtime_error("log_context exited without being entered");
+        py::object token = _tokens.back();
+        _tokens.pop_back();
+        reset_context(token);
+    }
+
+private:
+    py::dict _fields;
+    std::vector<py::object> _tokens;
+};
+#else
+const bound_context* current_context(py::object&)
+{
+    return nullptr;
+}
+#endif
+
+// One JSON object per line: time, level, logger, thread, the message and the fields of
+// structured records, then the static fields.
+class json_formatter : public spd::formatter {
+public:
+    // reserved lists the keys written for every record, fields of a record named like one of
+    // them are written as "fields.<name>" so no key appears twice in an object
+    json_formatter(std::string static_fields, std::vector<std::string> reserved, bool utc)
+        : _static_fields(std::move(static_fields))
+        , _reserved(std::move(reserved))
+        , _utc(utc)
+    {
+    }
+
+    void format(const spd::details::log_msg& msg, spd::memory_buf_t& dest) override
+    {
+        dest.append(spd::string_view_t("{\"time\":\""));
+        append_time_(msg.time, dest);
+        dest.append(spd::string_view_t("\",\"level\":\""));
+        dest.append(spd::level::to_string_view(msg.level));
+        dest.append(spd::string_view_t("\",\"logger\":"));
+        structured::append_quoted(msg.logger_name, dest);
+        fmt::format_to(fmt::appender(dest), ",\"thread\":{}", msg.thread_id);
+        if (structured::is_structured(msg)) {
+            spd::string_view_t rest = msg.payload, key, value;
+            // the first field is the message itself
+            for (bool first = true; structured::next_field(rest, key, value); first = false) {
+                dest.append(spd::string_view_t(",\""));
+                if (!first && is_reserved_(key))
+                    dest.append(spd::string_view_t("fields."));
+                dest.append(key);
+                dest.append(spd::string_view_t("\":"));
+                dest.append(value);
+            }
+        } else {
+            dest.append(spd::string_view_t(",\"msg\":"));
+            structured::append_quoted(msg.payload, dest);
+        }
+        dest.append(_static_fields);
+        dest.push_back('}');
+        dest.append(spd::string_view_t(spd::details::os::default_eol));
+    }
+
+    std::unique_ptr<spd::formatter> clone() const override
+    {
+        return spd::details::make_unique<json_formatter>(_static_fields, _reserved, _utc);
+    }
+
+private:
+    bool is_reserved_(spd::string_view_t key) const
+    {
+        for (const auto& name : _reserved)
+            if (spd::string_view_t(name) == key)
+                return true;
+        return false;
+    }
+
+    // ISO 8601 with microseconds, the part up to the seconds is cached
+    void append_time_(spd::log_clock::time_point time, spd::memory_buf_t& dest)
+    {
+        auto since_epoch = time.time_since_epoch();
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+        if (seconds.count() != _cached_seconds) {
+            _cached_seconds = seconds.count();
+            std::time_t tt = (std::time_t)_cached_seconds;
+            std::tm tm = _utc ? spd::details::os::gmtime(tt) : spd::details::os::localtime(tt);
+            _cached_prefix = fmt::format("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+            if (_utc) {
+                _cached_suffix = "Z";
+            } else {
+                int offset = spd::details::os::utc_minutes_offset(tm);
+                _cached_suffix = fmt::format("{}{:02}:{:02}", offset < 0 ? '-' : '+', std::abs(offset) / 60, std::abs(offset) % 60);
+            }
+        }
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(since_epoch - seconds).count();
+        dest.append(_cached_prefix);
+        fmt::format_to(fmt::appender(dest), ".{:06}", micros);
+        dest.append(_cached_suffix);
+    }
+
+    const std::string _static_fields;
+    const std::vector<std::string> _reserved;
+    const bool _utc;
+    int64_t _cached_seconds{ std::numeric_limits<int64_t>::min() };
+    std::string _cached_prefix;
+    std::string _cached_suffix;
+};
+
+// Python side configuration of a json_formatter, static fields are serialized once here.
+class JsonFormatter {
+public:
+    JsonFormatter(const py::dict& static_fields, bool hostname, bool pid, bool utc)
+        : _reserved{ "time", "level", "logger", "thread", "msg" }
+        , _utc(utc)
+    {
+        spd::memory_buf_t buf;
+        if (hostname) {
+            buf.append(spd::string_view_t(",\"hostname\":"));
+            structured::append_quoted(host_name(), buf);
+            _reserved.push_back("hostname");
+        }
+        if (pid) {
+            fmt::format_to(fmt::appender(buf), ",\"pid\":{}", spd::details::os::pid());
+            _reserved.push_back("pid");
+        }
+        for (auto item : static_fields) {
+            buf.append(spd::string_view_t(",\""));
+            structured::append_key(item.first, buf);
+            buf.append(spd::string_view_t("\":"));
+            structured::append_value(item.second, buf);
+            MessageView key(item.first);
+            std::string name(key.view().data(), key.view().size());
+            if (std::find(_reserved.begin(), _reserved.end(), name) != _reserved.end())
+                throw std::invalid_argument("static field " + name + " is already written by the formatter");
+            _reserved.push_back(std::move(name));
+        }
+        _static_fields.assign(buf.data(), buf.size());
+    }
+
+    std::unique_ptr<spd::formatter> make() const
+    {
+        return spd::details::make_unique<json_formatter>(_static_fields, _reserved, _utc);
+    }
+
+private:
+    static std::string host_name()
+    {
+#ifdef _WIN32
+        return spd::details::os::getenv("COMPUTERNAME");
+#else
+        char name[256] = {};
+        if (gethostname(name, sizeof(name) - 1) != 0)
+            return std::string();
+        return name;
+#endif
+    }
+
+    std::string _static_fields;
+    std::vector<std::string> _reserved;
+    bool _utc;
+};
+
+// Record filters attachable to a Logger (checked before the message is copied or queued) or
+// to a Sink. Filters are thread safe and can be shared, dropped() counts what they rejected.
+class LogFilter {
+public:
+    struct summary {
+        bool pending{ false };
+        spd::level::level_enum level{ spd::level::info };
+        std::string text;
+    };
+
+    explicit LogFilter(int max_level)
+        : _max_level((spd::level::level_enum)max_level)
+    {
+    }
+    virtual ~LogFilter() {}
+
+    // records above max_level are never filtered
+    bool applies_to(spd::level::level_enum level) const { return level <= _max_level; }
+    // filters needing the payload run after fmt style messages are formatted
+    virtual bool needs_payload() const { return false; }
+
+    // Decides on one record. A filter holding back records may ask for a summary of them
+    // to be logged before the record.
+    bool allow(spd::level::level_enum level, spd::string_view_t payload, summary& out)
+    {
+        bool allowed = allow_(level, payload, std::chrono::steady_clock::now(), out);
+        (allowed ? _passed : _dropped).fetch_add(1, std::memory_order_relaxed);
+        return allowed;
+    }
+
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+    uint64_t passed() const { return _passed.load(std::memory_order_relaxed); }
+    int max_level() const { return (int)_max_level; }
+
+protected:
+    virtual bool allow_(spd::level::level_enum level, spd::string_view_t payload, std::chrono::steady_clock::time_point now, summary& out) = 0;
+
+private:
+    const spd::level::level_enum _max_level;
+    std::atomic<uint64_t> _dropped{ 0 };
+    std::atomic<uint64_t> _passed{ 0 };
+};
+
+// Token bucket of rate records per second with room for burst records, one bucket per level
+// when per_level is set.
+class RateLimitFilter : public LogFilter {
+public:
+    RateLimitFilter(double rate, double burst, bool per_level, int max_level)
+        : LogFilter(max_level)
+        , _rate(rate)
+        , _burst(burst > 0 ? burst : std::max(rate, 1.0))
+        , _per_level(per_level)
+    {
+        if (rate <= 0)
+            throw std::invalid_argument("rate must be positive");
+        auto now = std::chrono::steady_clock::now();
+        for (auto& bucket : _buckets)
+            bucket = bucket_state{ _burst, now };
+    }
+
+protected:
+    bool allow_(spd::level::level_enum level, spd::string_view_t, std::chrono::steady_clock::time_point now, summary&) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        bucket_state& bucket = _buckets[_per_level ? (size_t)level : 0];
+        double elapsed = std::chrono::duration<double>(now - bucket.last).count();
+        bucket.tokens = std::min(_burst, bucket.tokens + elapsed * _rate);
+        bucket.last = now;
+        if (bucket.tokens < 1.0)
+            return false;
+        bucket.tokens -= 1.0;
+        return true;
+    }
+
+private:
+    struct bucket_state {
+        double tokens;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    const double _rate;
+    const double _burst;
+    const bool _per_level;
+    std::mutex _mutex;
+    bucket_state _buckets[spd::level::n_levels];
+};
+
+// Keeps one record out of every n.
+class SampleFilter : public LogFilter {
+public:
+    SampleFilter(uint64_t n, int max_level)
+        : LogFilter(max_level)
+        , _n(n)
+    {
+        if (n == 0)
+            throw std::invalid_argument("n must be positive");
+    }
+
+protected:
+    bool allow_(spd::level::level_enum, spd::string_view_t, std::chrono::steady_clock::time_point, summary&) override
+    {
+        return _counter.fetch_add(1, std::memory_order_relaxed) % _n == 0;
+    }
+
+private:
+    const uint64_t _n;
+    std::atomic<uint64_t> _counter{ 0 };
+};
+
+// Drops repeats of the previous record (same level and payload) for window seconds after it was
+// first let through. The next record let through is preceded by a summary of the dropped repeats.
+class DedupFilter : public LogFilter {
+public:
+    DedupFilter(double window, int max_level)
+        : LogFilter(max_level)
+        , _window(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(window)))
+    {
+        if (window <= 0)
+            throw std::invalid_argument("window must be positive");
+    }
+
+    bool needs_payload() const override { return true; }
+
+protected:
+    bool allow_(spd::level::level_enum level, spd::string_view_t payload, std::chrono::steady_clock::time_point now, summary& out) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        bool repeat = _has_last && level == _last_level && payload.size() == _last.size()
+            && std::equal(payload.data(), payload.data() + payload.size(), _last.data());
+        if (repeat && now - _first_seen < _window) {
+            ++_repeats;
+            return false;
+        }
+        if (_repeats > 0) {
+            out.pending = true;
+            out.level = _last_level;
+            out.text = fmt::format("Skipped {} duplicate messages", _repeats);
+        }
+        _has_last = true;
+        _last_level = level;
+        _last.assign(payload.data(), payload.size());
+        _first_seen = now;
+        _repeats = 0;
+        return true;
+    }
+
+private:
+    const std::chrono::steady_clock::duration _window;
+    std::mutex _mutex;
+    bool _has_last{ false };
+    spd::level::level_enum _last_level{ spd::level::off };
+    std::string _last;
+    std::chrono::steady_clock::time_point _first_seen;
+    uint64_t _repeats{ 0 };
+};
+
+typedef std::vector<std::shared_ptr<LogFilter>> filter_list;
+
+// Decorates a sink with filters. It holds no lock of its own, so the filters are the only
+// serialization added in front of the sink.
+class filter_sink : public spd::sinks::sink {
+public:
+    filter_sink(spd::sink_ptr inner, filter_list filters)
+        : _inner(std::move(inner))
+        , _filters(std::move(filters))
+    {
+        set_level(_inner->level());
+    }
+
+    void log(const spd::details::log_msg& msg) override
+    {
+        for (const auto& filter : _filters) {
+            if (!filter->applies_to(msg.level))
+                continue;
+            LogFilter::summary summary;
+            if (!filter->allow(msg.level, msg.payload, summary))
+                return;
+            if (summary.pending) {
+                spd::details::log_msg repeated(msg);
+                repeated.level = summary.level;
+                repeated.payload = summary.text;
+                _inner->log(repeated);
+            }
+        }
+        _inner->log(msg);
+    }
+    void flush() override
+    {
+        _inner->flush();
+    }
+    void set_pattern(const std::string& pattern) override
+    {
+        _inner->set_pattern(pattern);
+    }
+    void set_formatter(std::unique_ptr<spd::formatter> sink_formatter) override
+    {
+        _inner->set_formatter(std::move(sink_formatter));
+    }
+
+    const spd::sink_ptr& inner() const { return _inner; }
+    const filter_list& filters() const { return _filters; }
+
+private:
+    spd::sink_ptr _inner;
+    const filter_list _filters;
+};
+
+// The sinks of a Logger, behind one spdlog sink so they can be changed while records are
+// being logged. The list is copied on write and swapped atomically, writers only copy the
+// pointer and records already being written finish with the list they started with.
+class fanout_sink : public spd::sinks::sink {
+public:
+    typedef std::vector<spd::sink_ptr> sink_list;
+
+    explicit fanout_sink(sink_list sinks)
+        : _sinks(std::make_shared<const sink_list>(std::move(sinks)))
+    {
+    }
+
+    // Every sink gets the record even if an earlier one throws, the first error is rethrown.
+    void log(const spd::details::log_msg& msg) override
+    {
+        auto sinks = std::atomic_load(&_sinks);
+        std::exception_ptr error;
+        for (const auto& sink : *sinks) {
+            if (!sink->should_log(msg.level))
+                continue;
+            try {
+                sink->log(msg);
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+    void flush() override
+    {
+        auto sinks = std::atomic_load(&_sinks);
+        std::exception_ptr error;
+        for (const auto& sink : *sinks) {
+            try {
+                sink->flush();
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+    void set_pattern(const std::string& pattern) override
+    {
+        for (const auto& sink : *std::atomic_load(&_sinks))
+            sink->set_pattern(pattern);
+    }
+    void set_formatter(std::unique_ptr<spd::formatter> sink_formatter) override
+    {
+        for (const auto& sink : *std::atomic_load(&_sinks))
+            sink->set_formatter(sink_formatter->clone());
+    }
+
+    std::shared_ptr<const sink_list> sinks() const
+    {
+        return std::atomic_load(&_sinks);
+    }
+
+    void add(spd::sink_ptr sink)
+    {
+        std::lock_guard<std::mutex> lock(_update_mutex);
+        auto sinks = std::make_shared<sink_list>(*_sinks);
+        sinks->push_back(std::move(sink));
+        std::atomic_store(&_sinks, std::shared_ptr<const sink_list>(std::move(sinks)));
+    }
+
+    bool remove(const spd::sink_ptr& sink)
+    {
+        std::lock_guard<std::mutex> lock(_update_mutex);
+        auto sinks = std::make_shared<sink_list>(*_sinks);
+        auto it = std::find(sinks->begin(), sinks->end(), sink);
+        if (it == sinks->end())
+            return false;
+        sinks->erase(it);
+        std::atomic_store(&_sinks, std::shared_ptr<const sink_list>(std::move(sinks)));
+        return true;
+    }
+
+    void replace(sink_list sinks)
+    {
+        std::lock_guard<std::mutex> lock(_update_mutex);
+        std::atomic_store(&_sinks, std::make_shared<const sink_list>(std::move(sinks)));
+    }
+
+private:
+    std::shared_ptr<const sink_list> _sinks;
+    // serializes writers of the list, loggers never take it
+    std::mutex _update_mutex;
+};
+
+class Sink;
+
+// Buffers records on the logging thread (the worker of an async logger) and hands them to a
+// Python subclass of Sink in batches, so the GIL is taken once per batch instead of per record.
+// Batches are delivered after the sink's mutex is released, a thread waiting for the GIL never
+// blocks a Python thread that is logging.
+class python_batch_sink : public timed_flush_sink {
+public:
+    struct record {
+        spd::level::level_enum level;
+        spd::log_clock::time_point time;
+        size_t thread_id;
+        std::string logger_name;
+        std::string payload;
+    };
+
+    python_batch_sink(Sink* owner, size_t batch_size, std::chrono::milliseconds max_latency)
+        : _owner(owner)
+        , _batch_size(batch_size)
+        , _max_latency(max_latency)
+    {
+        _batch.reserve(batch_size);
+    }
+
+    void log(const spd::details::log_msg& msg) override
+    {
+        std::vector<record> ready;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_batch.empty())
+                _oldest = std::chrono::steady_clock::now();
+            _batch.push_back(record{ msg.level, msg.time, msg.thread_id,
+                std::string(msg.logger_name.data(), msg.logger_name.size()),
+                std::string(msg.payload.data(), msg.payload.size()) });
+            if (_batch.size() >= _batch_size)
+                take_(ready);
+        }
+        deliver_(ready);
+    }
+    void flush() override
+    {
+        std::vector<record> ready;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            take_(ready);
+        }
+        deliver_(ready);
+    }
+    // records are delivered unformatted
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spd::formatter>) override {}
+
+    void flush_if_due(std::chrono::steady_clock::time_point now) override
+    {
+        std::vector<record> ready;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_batch.empty() && now - _oldest >= _max_latency)
+                take_(ready);
+        }
+        deliver_(ready);
+    }
+    std::chrono::milliseconds max_interval() const override { return _max_latency; }
+    // held across a fork, see lock_for_fork
+    std::mutex& mutex() { return _mutex; }
+
+    // Called when the Python object goes away, later batches are dropped.
+    void detach()
+    {
+        std::lock_guard<std::mutex> lock(_owner_mutex);
+        _owner = nullptr;
+    }
+
+private:
+    void take_(std::vector<record>& ready)
+    {
+        ready.swap(_batch);
+        _batch.reserve(_batch_size);
+    }
+
+    void deliver_(std::vector<record>& records);
+
+    // The GIL does not serialize threads on free-threaded builds, deliver_ takes a reference to the
+    // Python object under _owner_mutex before calling it.
+    std::mutex _owner_mutex;
+    Sink* _owner;
+    const size_t _batch_size;
+    const std::chrono::milliseconds _max_latency;
+    std::mutex _mutex;
+    std::vector<record> _batch;
+    std::chrono::steady_clock::time_point _oldest;
+};
+
+// Creates a sink formatting with structured::make_pattern_formatter, spdlog's default pattern
+// would print structured records as they are stored.
+template <typename T, typename... Args>
+std::shared_ptr<T> make_sink(Args&&... args)
+{
+    auto sink = std::make_shared<T>(std::forward<Args>(args)...);
+    sink->set_formatter(structured::make_pattern_formatter("%+"));
+    return sink;
+}
+
+class Sink {
+public:
+    Sink() {}
+    Sink(const spd::sink_ptr& sink)
+        : _sink(sink)
+    {
+    }
+    virtual ~Sink() {}
+    virtual void log(const spd::details::log_msg& msg)
+    {
+        _sink->log(msg);
+    }
+    // Implemented by Python subclasses, receives lists of (level, time, thread_id, logger_name, payload) tuples.
+    virtual void log_batch(const py::list& records)
+    {
+        throw std::logic_error("log_batch is only implemented by Python subclasses of Sink");
+    }
+    bool should_log(int msg_level) const
+    {
+        return _sink->should_log((spd::level::level_enum)msg_level);
+    }
+    void set_level(int log_level)
+    {
+        _sink->set_level((spd::level::level_enum)log_level);
+    }
+    int level() const
+    {
+        return (int)_sink->level();
+    }
+
+    void flush()
+    {
+        _sink->flush();
+    }
+
+    void set_pattern(const std::string& pattern)
+    {
+        _sink->set_formatter(structured::make_pattern_formatter(pattern));
+    }
+
+    void set_formatter(const JsonFormatter& formatter)
+    {
+        _sink->set_formatter(formatter.make());
+    }
+
+    // Flush after max_bytes of payload or max_ms milliseconds, whichever comes first (0 disables
+    // either bound, both 0 removes the policy). Must be set before the sink is given to a logger.
+    void set_flush_policy(size_t max_bytes, int64_t max_ms)
+    {
+        if (max_ms < 0)
+            throw std::invalid_argument("max_ms must not be negative");
+        if (std::dynamic_pointer_cast<python_batch_sink>(_sink))
+            throw std::invalid_argument("Python sinks are flushed by their batch_size and max_latency_ms");
+        if (auto policy = std::dynamic_pointer_cast<flush_policy_sink>(_sink))
+            _sink = policy->inner();
+        if (max_bytes == 0 && max_ms == 0)
+            return;
+        auto policy = std::make_shared<flush_policy_sink>(_sink, max_bytes, std::chrono::milliseconds(max_ms));
+        if (max_ms > 0)
+            policy_flusher::instance().add(policy);
+        _sink = policy;
+    }
+
+    // Filters run in the order they were added, before the record is formatted. Must be added
+    // before the sink is given to a logger.
+    void add_filter(std::shared_ptr<LogFilter> filter)
+    {
+        if (!filter)
+            throw std::invalid_argument("filter must not be None");
+        filter_list filters;
+        auto inner = _sink;
+        if (auto filtered = std::dynamic_pointer_cast<filter_sink>(_sink)) {
+            filters = filtered->filters();
+            inner = filtered->inner();
+        }
+        filters.push_back(std::move(filter));
+        _sink = std::make_shared<filter_sink>(inner, std::move(filters));
+    }
+
+    filter_list filters() const
+    {
+        if (auto filtered = std::dynamic_pointer_cast<filter_sink>(_sink))
+            return filtered->filters();
+        return filter_list();
+    }
+
+    spd::sink_ptr get_sink() const { return _sink; }
+
+protected:
+    spd::sink_ptr _sink{ nullptr };
+};
+
+// Trampoline for Sink subclasses written in Python, see python_batch_sink.
+class PySink : public Sink {
+public:
+    PySink(size_t batch_size, int64_t max_latency_ms)
+    {
+        if (batch_size == 0)
+            throw std::invalid_argument("batch_size must be positive");
+        if (max_latency_ms < 0)
+            throw std::invalid_argument("max_latency_ms must not be negative");
+        auto sink = std::make_shared<python_batch_sink>(this, batch_size, std::chrono::milliseconds(max_latency_ms));
+        if (max_latency_ms > 0)
+            policy_flusher::instance().add(sink);
+        _sink = sink;
+    }
+    PySink(const PySink&) = delete;
+    ~PySink() override
+    {
+        std::static_pointer_cast<python_batch_sink>(_sink)->detach();
+    }
+
+    void log_batch(const py::list& records) override
+    {
+        PYBIND11_OVERRIDE_PURE(void, Sink, log_batch, records);
+    }
+};
+
+void python_batch_sink::deliver_(std::vector<record>& records)
+{
+    if (records.empty() || !Py_IsInitialized())
+        return;
+#if PY_VERSION_HEX >= 0x030D0000
+    if (Py_IsFinalizing())
+        return;
+#else
+    if (_Py_IsFinalizing())
+        return;
+#endif
+    py::gil_scoped_acquire gil;
+    Sink* owner;
+    py::object keep_alive;
+    {
+        std::lock_guard<std::mutex> lock(_owner_mutex);
+        owner = _owner;
+        if (owner == nullptr)
+            return;
+        keep_alive = py::cast(owner, py::return_value_policy::reference);
+    }
+    try {
+        py::list batch;
+        for (const auto& r : records)
+            batch.append(record_tuple(r.level, r.time, r.thread_id, r.logger_name, r.payload));
+        owner->log_batch(batch);
+    } catch (py::error_already_set& e) {
+        e.discard_as_unraisable("spdlog.Sink.log_batch");
+    }
+}
+
+// template <class sink_type>
+// class generic_sink : public Sink {
+// public:
+//     generic_sink() {
+//         _sink = std::make_shared<sink_type>();
+//     }
+// };
+
+// class stdout_sink_st : public generic_sink<spdlog::sinks::stdout_sink_st> { };
+// class stdout_sink_mt : public generic_sink<spdlog::sinks::stdout_sink_mt> { };
+
+class stdout_sink_st : public Sink {
+public:
+    stdout_sink_st()
+    {
+        _sink = make_sink<spdlog::sinks::stdout_sink_st>();
+    }
+};
+
+class stdout_sink_mt : public Sink {
+public:
+    stdout_sink_mt()
+    {
+        _sink = make_sink<spdlog::sinks::stdout_sink_mt>();
+    }
+};
+
+class stdout_color_sink_st : public Sink {
+public:
+    stdout_color_sink_st()
+    {
+        _sink = make_sink<spdlog::sinks::stdout_color_sink_st>();
+    }
+};
+
+class stdout_color_sink_mt : public Sink {
+public:
+    stdout_color_sink_mt()
+    {
+        _sink = make_sink<spdlog::sinks::stdout_color_sink_mt>();
+    }
+};
+
+class stderr_sink_st : public Sink {
+public:
+    stderr_sink_st()
+    {
+        _sink = make_sink<spdlog::sinks::stderr_sink_st>();
+    }
+};
+
+class stderr_sink_mt : public Sink {
+public:
+    stderr_sink_mt()
+    {
+        _sink = make_sink<spdlog::sinks::stderr_sink_mt>();
+    }
+};
+
+class stderr_color_sink_st : public Sink {
+public:
+    stderr_color_sink_st()
+    {
+        _sink = make_sink<spdlog::sinks::stderr_color_sink_st>();
+    }
+};
+
+class stderr_color_sink_mt : public Sink {
+public:
+    stderr_color_sink_mt()
+    {
+        _sink = make_sink<spdlog::sinks::stderr_color_sink_mt>();
+    }
+};
+
+class basic_file_sink_st : public Sink {
+public:
+    basic_file_sink_st(const std::string& base_filename, bool truncate, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::basic_file_sink_st>(base_filename, truncate, buffered_file_handlers(buffer_size));
+    }
+};
+
+class basic_file_sink_mt : public Sink {
+public:
+    basic_file_sink_mt(const std::string& base_filename, bool truncate, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::basic_file_sink_mt>(base_filename, truncate, buffered_file_handlers(buffer_size));
+    }
+};
+
+class daily_file_sink_mt : public Sink {
+public:
+    daily_file_sink_mt(const std::string& base_filename, int rotation_hour, int rotation_minute, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::daily_file_sink_mt>(base_filename, rotation_hour, rotation_minute, false, 0, buffered_file_handlers(buffer_size));
+    }
+};
+
+class daily_file_sink_st : public Sink {
+public:
+    daily_file_sink_st(const std::string& base_filename, int rotation_hour, int rotation_minute, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::daily_file_sink_st>(base_filename, rotation_hour, rotation_minute, false, 0, buffered_file_handlers(buffer_size));
+    }
+};
+
+class rotating_file_sink_mt : public Sink {
+public:
+    rotating_file_sink_mt(const std::string& filename, size_t max_file_size, size_t max_files, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::rotating_file_sink_mt>(filename, max_file_size, max_files, false, buffered_file_handlers(buffer_size));
+    }
+};
+
+class rotating_file_sink_st : public Sink {
+public:
+    rotating_file_sink_st(const std::string& filename, size_t max_file_size, size_t max_files, size_t buffer_size = 0)
+    {
+        _sink = make_sink<spdlog::sinks::rotating_file_sink_st>(filename, max_file_size, max_files, false, buffered_file_handlers(buffer_size));
+    }
+};
+
+#ifndef _WIN32
+class mmap_file_sink_st : public Sink {
+public:
+    mmap_file_sink_st(const std::string& filename, size_t segment_size, bool truncate, bool sync_on_flush)
+    {
+        _sink = make_sink<mmap_sink<spd::details::null_mutex>>(filename, segment_size, truncate, sync_on_flush);
+    }
+};
+
+class mmap_file_sink_mt : public Sink {
+public:
+    mmap_file_sink_mt(const std::string& filename, size_t segment_size, bool truncate, bool sync_on_flush)
+    {
+        _sink = make_sink<mmap_sink<std::mutex>>(filename, segment_size, truncate, sync_on_flush);
+    }
+};
+#endif
+
+#ifdef SPDLOG_ENABLE_ZLIB
+py::dict compression_stats(const CompressionStats& stats)
+{
+    uint64_t bytes_in = stats.bytes_in, bytes_out = stats.bytes_out, nanoseconds = stats.nanoseconds;
+    py::dict result;
+    result["files"] = (uint64_t)stats.files;
+    result["pending"] = (uint64_t)stats.pending;
+    result["bytes_in"] = bytes_in;
+    result["bytes_out"] = bytes_out;
+    result["ratio"] = bytes_out > 0 ? (double)bytes_in / bytes_out : 0.0;
+    result["bytes_per_second"] = nanoseconds > 0 ? bytes_in * 1e9 / nanoseconds : 0.0;
+    return result;
+}
+
+template <typename Mutex>
+class compressed_rotating_file_sink : public Sink {
+public:
+    compressed_rotating_file_sink(const std::string& filename, size_t max_file_size, size_t max_files, int compression_level, bool streaming)
+    {
+        auto sink = make_sink<compressed_rotating_sink<Mutex>>(filename, max_file_size, max_files, compression_level, streaming);
+        _stats = sink->stats();
+        _sink = sink;
+    }
+
+    // totals over the compressed files, ratio is uncompressed / compressed size
+    py::dict compression_stats() const { return ::compression_stats(*_stats); }
+
+private:
+    std::shared_ptr<CompressionStats> _stats;
+};
+
+class compressed_rotating_file_sink_st : public compressed_rotating_file_sink<spd::details::null_mutex> {
+    using compressed_rotating_file_sink::compressed_rotating_file_sink;
+};
+
+class compressed_rotating_file_sink_mt : public compressed_rotating_file_sink<std::mutex> {
+    using compressed_rotating_file_sink::compressed_rotating_file_sink;
+};
+#endif
+
+class binary_file_sink_st : public Sink {
+public:
+    binary_file_sink_st(const std::string& filename, bool truncate)
+    {
+        _sink = make_sink<binary_sink<spd::details::null_mutex>>(filename, truncate);
+    }
+};
+
+class binary_file_sink_mt : public Sink {
+public:
+    binary_file_sink_mt(const std::string& filename, bool truncate)
+    {
+        _sink = make_sink<binary_sink<std::mutex>>(filename, truncate);
+    }
+};
+
+// Decoder for files written by binary_file_sink_*, read() and iteration return the same
+// (level, time, thread_id, logger_name, payload) tuples as Python sinks receive.
+class BinaryLogReader {
+public:
+    BinaryLogReader(const std::string& filename)
+        : _reader(new binary_log_reader(filename))
+    {
+    }
+
+    // the next count records, all remaining ones when count is 0, an empty list at the end
+    py::list read(size_t count)
+    {
+        py::list records;
+        binary_log_reader::record r;
+        for (size_t n = 0; (count == 0 || n < count) && _reader->next(r); ++n)
+            records.append(record_tuple(r.level, r.time, r.thread_id, *r.logger_name, r.payload));
+        return records;
+    }
+
+    py::tuple next()
+    {
+        binary_log_reader::record r;
+        if (!_reader->next(r))
+            throw py::stop_iteration();
+        return record_tuple(r.level, r.time, r.thread_id, *r.logger_name, r.payload);
+    }
+
+    // Formats the remaining records with pattern into output_filename, returns their number.
+    size_t render(const std::string& output_filename, const std::string& pattern)
+    {
+        py::gil_scoped_release release;
+        auto formatter = structured::make_pattern_formatter(pattern);
+        spd::details::file_helper output;
+        output.open(output_filename, true);
+        spd::memory_buf_t buf;
+        binary_log_reader::record r;
+        size_t count = 0;
+        while (_reader->next(r)) {
+            spd::details::log_msg msg(r.time, spd::source_loc{}, *r.logger_name, r.level, r.payload);
+            msg.thread_id = r.thread_id;
+            buf.clear();
+            formatter->format(msg, buf);
+            output.write(buf);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    std::unique_ptr<binary_log_reader> _reader;
+};
+
+#ifndef _WIN32
+class shared_memory_sink_mt : public Sink {
+public:
+    shared_memory_sink_mt(const std::string& name, int overflow_policy)
+    {
+        _sink = make_sink<shared_memory_sink>(name, (spd::async_overflow_policy)overflow_policy);
+    }
+};
+
+// Owns a shm_ring and feeds the records written into it by other processes to real sinks,
+// either from its own thread (start/stop) or from the caller (poll).
+class SharedMemoryCollector : public fork_thread_owner {
+public:
+    SharedMemoryCollector(const std::string& name, const std::vector<Sink>& sinks, size_t capacity, bool force)
+        : _ring(new shm_ring(name, capacity, true, force))
+    {
+        for (const auto& sink : sinks)
+            _sinks.push_back(sink.get_sink());
+        add_thread_owner(this);
+    }
+
+    ~SharedMemoryCollector()
+    {
+        erase_fork_entry(g_thread_owners, static_cast<fork_thread_owner*>(this));
+        // sinks written in Python need the GIL on the collector thread
+        if (PyGILState_Check()) {
+            py::gil_scoped_release release;
+            stop_();
+        } else {
+            stop_();
+        }
+    }
+
+    // Polls the ring every poll_interval_ms milliseconds while it is empty, flushing the sinks
+    // whenever it runs dry.
+    void start(double poll_interval_ms)
+    {
+        if (_thread.joinable())
+            throw std::logic_error("collector already started");
+        auto interval = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double, std::milli>(poll_interval_ms));
+        _stop = false;
+        _thread = std::thread([this, interval] {
+            bool dirty = false;
+            while (!_stop.load(std::memory_order_relaxed)) {
+                if (drain_() > 0) {
+                    dirty = true;
+                    continue;
+                }
+                if (dirty) {
+                    flush_();
+                    dirty = false;
+                }
+                std::this_thread::sleep_for(interval);
+            }
+        });
+    }
+
+    // Stops the thread after collecting what is in the ring, then flushes the sinks.
+    void stop()
+    {
+        py::gil_scoped_release release;
+        stop_();
+    }
+
+    // Collects what is in the ring on the calling thread, returns the number of records.
+    size_t poll()
+    {
+        if (_thread.joinable())
+            throw std::logic_error("poll() cannot be used while the collector thread runs");
+        py::gil_scoped_release release;
+        size_t count = drain_();
+        flush_();
+        return count;
+    }
+
+    uint64_t collected() const { return _collected; }
+    uint64_t dropped() const { return _ring->dropped(); }
+    size_t capacity() const { return (size_t)_ring->capacity(); }
+    bool running() const { return _thread.joinable(); }
+
+    std::vector<spd::sink_ptr> fork_sinks() const override { return _sinks; }
+
+    // The ring and its records stay with the parent's collector, the child's one is stopped.
+    void restart_after_fork() override
+    {
+        abandon_thread(_thread);
+        _ring->disown();
+    }
+
+private:
+    size_t drain_()
+    {
+        size_t count = _ring->drain([this](const spd::details::log_msg& msg) {
+            for (const auto& sink : _sinks) {
+                if (!sink->should_log(msg.level))
+                    continue;
+                try {
+                    sink->log(msg);
+                } catch (const std::exception& ex) {
+                    std::cerr << "[spdlog] collector sink error: " << ex.what() << std::endl;
+                }
+            }
+        });
+        _collected += count;
+        return count;
+    }
+
+    void flush_()
+    {
+        for (const auto& sink : _sinks) {
+            try {
+                sink->flush();
+            } catch (const std::exception& ex) {
+                std::cerr << "[spdlog] collector sink error: " << ex.what() << std::endl;
+            }
+        }
+    }
+
+    void stop_()
+    {
+        if (!_thread.joinable())
+            return;
+        _stop = true;
+        _thread.join();
+        drain_();
+        flush_();
+    }
+
+    std::unique_ptr<shm_ring> _ring;
+    std::vector<spd::sink_ptr> _sinks;
+    std::thread _thread;
+    std::atomic<bool> _stop{ false };
+    std::atomic<uint64_t> _collected{ 0 };
+};
+#endif
+
+class null_sink_st : public Sink {
+public:
+    null_sink_st()
+    {
+        _sink = make_sink<spdlog::sinks::null_sink_st>();
+    }
+};
+
+class null_sink_mt : public Sink {
+public:
+    null_sink_mt()
+    {
+        _sink = make_sink<spdlog::sinks::null_sink_mt>();
+    }
+};
+
+class tcp_sink_st : public Sink {
+public:
+    tcp_sink_st(std::string server_host, int server_port, bool lazy_connect)
+    {
+        struct spdlog::sinks::tcp_sink_config tcp_config(server_host, server_port);
+        tcp_config.lazy_connect = lazy_connect;
+
+        _sink = make_sink<spdlog::sinks::tcp_sink_st>(tcp_config);
+    }
+};
+
+class tcp_sink_mt : public Sink {
+public:
+    tcp_sink_mt(std::string server_host, int server_port, bool lazy_connect)
+    {
+        struct spdlog::sinks::tcp_sink_config tcp_config(server_host, server_port);
+        tcp_config.lazy_connect = lazy_connect;
+
+        _sink = make_sink<spdlog::sinks::tcp_sink_mt>(tcp_config);
+    }
+};
+
+#ifdef SPDLOG_ENABLE_SYSLOG
+class syslog_sink_st : public Sink {
+public:
+    syslog_sink_st(const std::string& ident = "", int syslog_option = 0, int syslog_facility = (1 << 3), bool enable_formatting = true)
+    {
+        _sink = make_sink<spdlog::sinks::syslog_sink_st>(ident, syslog_option, syslog_facility, enable_formatting);
+    }
+};
+
+class syslog_sink_mt : public Sink {
+public:
+    syslog_sink_mt(const std::string& ident = "", int syslog_option = 0, int syslog_facility = (1 << 3), bool enable_formatting = true)
+    {
+        _sink = make_sink<spdlog::sinks::syslog_sink_mt>(ident, syslog_option, syslog_facility, enable_formatting);
+    }
+};
+#endif
+
+class AsyncOverflowPolicy {
+public:
+    const static int block{ (int)spd::async_overflow_policy::block };
+    const static int overrun_oldest{ (int)spd::async_overflow_policy::overrun_oldest };
+};
+
+// Index of the current async worker thread within its pool, assigned when the worker starts.
+thread_local size_t t_async_worker_index = 0;
+// Enqueue time (log_clock ticks) of the message the current async worker is writing, 0 when the
+// message was not stamped and its own time is the enqueue time.
+thread_local spd::log_clock::rep t_enqueued_at = 0;
+
+// Counters of an async thread pool. Updated with relaxed atomics on the logging path,
+// so reading them from python once in a while is cheap.
+class AsyncStats {
+public:
+    // bucket i counts messages that waited less than 2^i microseconds, the last one everything slower
+    static const size_t latency_buckets = 32;
+
+    AsyncStats(size_t queue_size, size_t thread_count)
+        : _queue_size(queue_size)
+        , _thread_count(thread_count)
+        , _processed(new std::atomic<uint64_t>[thread_count])
+    {
+        reset_counters_();
+    }
+
+    void set_thread_pool(const std::shared_ptr<spd::details::thread_pool>& tp) { _tp = tp; }
+
+    void on_worker_start()
+    {
+        t_async_worker_index = _next_worker.fetch_add(1, std::memory_order_relaxed) % _thread_count;
+    }
+
+    void on_enqueue(uint64_t count = 1)
+    {
+        _enqueued.fetch_add(count, std::memory_order_relaxed);
+        _total_enqueued.fetch_add(count, std::memory_order_relaxed);
+        int64_t in_flight = _in_flight.fetch_add((int64_t)count, std::memory_order_relaxed) + (int64_t)count;
+        int64_t high_water_mark = _high_water_mark.load(std::memory_order_relaxed);
+        while (in_flight > high_water_mark && !_high_water_mark.compare_exchange_weak(high_water_mark, in_flight, std::memory_order_relaxed)) {
+        }
+    }
+
+    void on_processed(spd::log_clock::duration latency)
+    {
+        _in_flight.fetch_sub(1, std::memory_order_relaxed);
+        _total_processed.fetch_add(1, std::memory_order_relaxed);
+        _processed[t_async_worker_index].fetch_add(1, std::memory_order_relaxed);
+        int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        size_t bucket = 0;
+        while (bucket < latency_buckets - 1 && us >= ((int64_t)1 << bucket))
+            ++bucket;
+        _latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t queue_size() const { return _queue_size; }
+    size_t thread_count() const { return _thread_count; }
+
+    size_t queue_depth() const
+    {
+        auto tp = _tp.lock();
+        return tp ? tp->queue_size() : 0;
+    }
+
+    // overrun messages are never processed, so the estimate is capped at the queue capacity
+    size_t high_water_mark() const
+    {
+        return (size_t)std::min<int64_t>(std::max<int64_t>(_high_water_mark.load(std::memory_order_relaxed), 0), (int64_t)_queue_size);
+    }
+
+    size_t overrun_count() const
+    {
+        auto tp = _tp.lock();
+        return tp ? tp->overrun_counter() : 0;
+    }
+
+    uint64_t enqueued() const { return _enqueued.load(std::memory_order_relaxed); }
+
+    uint64_t processed() const
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < _thread_count; ++i)
+            total += _processed[i].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::vector<uint64_t> processed_per_worker() const
+    {
+        std::vector<uint64_t> processed;
+        for (size_t i = 0; i < _thread_count; ++i)
+            processed.push_back(_processed[i].load(std::memory_order_relaxed));
+        return processed;
+    }
+
+    // (upper bound in microseconds, count) pairs, the last bound is infinity
+    std::vector<std::pair<double, uint64_t>> latency_histogram() const
+    {
+        std::vector<std::pair<double, uint64_t>> histogram;
+        for (size_t i = 0; i < latency_buckets; ++i) {
+            double bound = i < latency_buckets - 1 ? (double)((uint64_t)1 << i) : std::numeric_limits<double>::infinity();
+            histogram.emplace_back(bound, _latency[i].load(std::memory_order_relaxed));
+        }
+        return histogram;
+    }
+
+    void reset()
+    {
+        reset_counters_();
+        _high_water_mark.store(_in_flight.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        auto tp = _tp.lock();
+        if (tp) {
+            _overruns_before_reset.fetch_add(tp->overrun_counter(), std::memory_order_relaxed);
+            tp->reset_overrun_counter();
+        }
+    }
+
+    // Totals since the pool was created, not affected by reset().
+    uint64_t total_enqueued() const { return _total_enqueued.load(std::memory_order_relaxed); }
+
+    // messages written to the sinks or dropped by overrun_oldest
+    uint64_t total_done() const
+    {
+        auto tp = _tp.lock();
+        uint64_t overruns = _overruns_before_reset.load(std::memory_order_relaxed) + (tp ? tp->overrun_counter() : 0);
+        return _total_processed.load(std::memory_order_relaxed) + overruns;
+    }
+
+private:
+    void reset_counters_()
+    {
+        _enqueued.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < _thread_count; ++i)
+            _processed[i].store(0, std::memory_order_relaxed);
+        for (auto& bucket : _latency)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+
+    const size_t _queue_size;
+    const size_t _thread_count;
+    std::weak_ptr<spd::details::thread_pool> _tp;
+    std::atomic<size_t> _next_worker{ 0 };
+    std::atomic<uint64_t> _enqueued{ 0 };
+    std::atomic<uint64_t> _total_enqueued{ 0 };
+    std::atomic<uint64_t> _total_processed{ 0 };
+    std::atomic<uint64_t> _overruns_before_reset{ 0 };
+    std::atomic<int64_t> _in_flight{ 0 };
+    std::atomic<int64_t> _high_water_mark{ 0 };
+    std::unique_ptr<std::atomic<uint64_t>[]> _processed;
+    std::atomic<uint64_t> _latency[latency_buckets];
+};
+
+// spd::logger::log_it_ is protected and async_logger final: reaches it to queue a log_msg prepared
+// here. Messages logged with a caller supplied time (log_many, LoggingHandler, backtrace replay)
+// carry their enqueue time in color_range_start, log_msg has no other field for it, until
+// enqueue_stamp_sink takes it out on the worker.
+struct stamped_log : spd::logger {
+    static void log(spd::logger& logger, spd::log_clock::time_point time, spd::source_loc loc, spd::level::level_enum level, spd::string_view_t payload)
+    {
+        spd::details::log_msg msg(time, loc, logger.name(), level, payload);
+        msg.color_range_start = (size_t)spd::log_clock::now().time_since_epoch().count();
+        (logger.*(&stamped_log::log_it_))(msg, logger.should_log(level), logger.should_backtrace());
+    }
+};
+
+// First sink of every async logger, see async_sink_chain: moves the stamp of stamped_log out of
+// the message before a color sink could see it.
+class enqueue_stamp_sink : public spd::sinks::sink {
+public:
+    void log(const spd::details::log_msg& msg) override
+    {
+        t_enqueued_at = (spd::log_clock::rep)msg.color_range_start;
+        msg.color_range_start = 0;
+        msg.color_range_end = 0;
+    }
+    void flush() override {}
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spd::formatter>) override {}
+};
+
+// Appended as the last sink of every async logger, so it sees each message after the real sinks wrote it.
+class async_stats_sink : public spd::sinks::sink {
+public:
+    explicit async_stats_sink(std::shared_ptr<AsyncStats> stats)
+        : _stats(std::move(stats))
+    {
+    }
+    void log(const spd::details::log_msg& msg) override
+    {
+        auto enqueued = t_enqueued_at != 0 ? spd::log_clock::time_point(spd::log_clock::duration(t_enqueued_at)) : msg.time;
+        t_enqueued_at = 0;
+        _stats->on_processed(spd::log_clock::now() - enqueued);
+    }
+    void flush() override {}
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spd::formatter>) override {}
+
+private:
+    std::shared_ptr<AsyncStats> _stats;
+};
+
+// Pins the calling worker thread to the given cpus and sets its nice value (0 keeps the inherited one).
+// Returns 0 or an errno value.
+int setup_worker_thread(const std::vector<int>& cpu_affinity, int nice)
+{
+#ifdef __linux__
+    if (!cpu_affinity.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : cpu_affinity)
+            CPU_SET(cpu, &cpus);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (rc != 0)
+            return rc;
+    }
+    // on linux the nice value of a thread id only applies to that thread
+    if (nice != 0 && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0)
+        return errno;
+    return 0;
+#else
+    return cpu_affinity.empty() && nice == 0 ? 0 : ENOTSUP;
+#endif
+}
+
+// Objects inherited by a forked child that must never be destroyed there: thread pools and gates
+// whose workers were not copied into the child, their destructors would wait for those forever.
+std::vector<std::shared_ptr<void>>& abandoned_after_fork()
+{
+    static auto* abandoned = new std::vector<std::shared_ptr<void>>();
+    return *abandoned;
+}
+
+// Parks the workers of a thread pool while the process forks, so none of them is inside a sink,
+// holding its lock or half way through a write, when the child is copied. Each worker stops when
+// it reaches one of the pause records posted to the pool.
+class fork_gate {
+public:
+    fork_gate(const std::shared_ptr<spd::details::thread_pool>& tp, size_t workers)
+        : _sink(std::make_shared<gate_sink>())
+        , _poster(std::make_shared<spd::async_logger>("fork gate", _sink, tp, spd::async_overflow_policy::block))
+        , _workers(workers)
+    {
+        // posting fails once the pool is gone, the gate is retired by then
+        _poster->set_error_handler([](const std::string&) {});
+    }
+
+    // Called with the GIL: loggers check closed() under it before they queue a record.
+    void close() { _sink->close(); }
+
+    bool closed() const { return _sink->closed(); }
+
+    // Returns false when some worker did not stop before deadline, e.g. because a sink blocks.
+    // Must be called without the GIL, workers may need it to get through a Python sink.
+    bool pause(std::chrono::steady_clock::time_point deadline)
+    {
+        if (!_sink->closed())
+            return true;
+        for (size_t i = 0; i < _workers; ++i)
+            _poster->info("");
+        // producers using overrun_oldest can overwrite a pause record, post another until all stopped
+        while (!_sink->wait_for(_workers, std::chrono::milliseconds(10))) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            _poster->info("");
+        }
+        return true;
+    }
+
+    void resume() { _sink->open(); }
+
+    // Called before the pool is destroyed, its workers must get through to exit.
+    void retire() { _sink->retire(); }
+
+private:
+    class gate_sink : public spd::sinks::sink {
+    public:
+        void log(const spd::details::log_msg&) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_closed)
+                return;
+            ++_waiting;
+            _cv.notify_all();
+            _cv.wait(lock, [this] { return !_closed.load(); });
+            --_waiting;
+        }
+        void flush() override {}
+        void set_pattern(const std::string&) override {}
+        void set_formatter(std::unique_ptr<spd::formatter>) override {}
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = !_retired;
+        }
+
+        bool closed() const { return _closed.load(std::memory_order_relaxed); }
+
+        void open()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = false;
+            _cv.notify_all();
+        }
+
+        void retire()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _retired = true;
+            _closed = false;
+            _cv.notify_all();
+        }
+
+        bool wait_for(size_t workers, std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _cv.wait_for(lock, timeout, [&] { return _retired || _waiting >= workers; });
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::atomic<bool> _closed{ false };
+        bool _retired{ false };
+        size_t _waiting{ 0 };
+    };
+
+    std::shared_ptr<gate_sink> _sink;
+    std::shared_ptr<spd::async_logger> _poster;
+    const size_t _workers;
+};
+
+class AsyncPool;
+
+// Every thread pool and logger alive, including those dropped from the registry, for the fork
+// hooks. Entries are removed before the objects are destroyed.
+std::vector<AsyncPool*> g_pools;
+std::vector<Logger*> g_live_loggers;
+
+// spdlog thread pool together with its statistics and overflow policy.
+// Shared by the loggers using it, the workers are joined when the last one is dropped.
+class AsyncPool {
+public:
+    AsyncPool(size_t queue_size, size_t thread_count, int overflow_policy = AsyncOverflowPolicy::block,
+        const std::vector<int>& cpu_affinity = {}, int nice = 0)
+        : _overflow_policy(static_cast<spd::async_overflow_policy>(overflow_policy))
+        , _cpu_affinity(cpu_affinity)
+        , _nice(nice)
+    {
+        if (thread_count == 0)
+            throw std::invalid_argument("thread_count must be at least 1");
+        for (int cpu : cpu_affinity) {
+#ifdef __linux__
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+#else
+            if (cpu < 0)
+#endif
+                throw std::invalid_argument("invalid cpu in cpu_affinity: " + std::to_string(cpu));
+        }
+        start_(queue_size, thread_count);
+        std::lock_guard<std::mutex> lock(mutex_fork);
+        g_pools.push_back(this);
+    }
+
+    ~AsyncPool()
+    {
+        erase_fork_entry(g_pools, this);
+        if (_gate)
+            _gate->retire();
+        // joining the workers waits for one delivering to a Python sink, which needs the GIL
+        if (Py_IsInitialized() && PyGILState_Check()) {
+            py::gil_scoped_release release;
+            _tp.reset();
+        } else {
+            _tp.reset();
+        }
+    }
+
+    const std::shared_ptr<spd::details::thread_pool>& tp() const { return _tp; }
+    const std::shared_ptr<AsyncStats>& stats() const { return _stats; }
+    const spd::sink_ptr& stats_sink() const { return _stats_sink; }
+    const spd::sink_ptr& stamp_sink() const { return _stamp_sink; }
+    const std::shared_ptr<fork_gate>& gate() const { return _gate; }
+    spd::async_overflow_policy overflow_policy() const { return _overflow_policy; }
+
+    // Set once a logger on the pool writes to a Python sink: the workers then need the GIL, so
+    // no logger on the pool may hold it while blocked on the full queue.
+    void add_python_sink() { _has_python_sink = true; }
+    bool has_python_sink() const { return _has_python_sink; }
+    size_t queue_size() const { return _stats->queue_size(); }
+    size_t thread_count() const { return _stats->thread_count(); }
+    const std::vector<int>& cpu_affinity() const { return _cpu_affinity; }
+    int nice() const { return _nice; }
+
+    // Waits until every message enqueued before the call was written or the deadline passed.
+    // Returns the number of those messages still pending. Must be called without the GIL.
+    uint64_t drain(std::chrono::steady_clock::time_point deadline) const
+    {
+        const uint64_t target = _stats->total_enqueued();
+        for (;;) {
+            uint64_t done = _stats->total_done();
+            if (done >= target)
+                return 0;
+            if (std::chrono::steady_clock::now() >= deadline)
+                return target - done;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // In a forked child: the workers were not copied, the records still queued belong to the
+    // parent. Starts new workers on an empty queue with fresh statistics, same settings.
+    void restart_after_fork()
+    {
+        abandoned_after_fork().push_back(std::move(_tp));
+        abandoned_after_fork().push_back(std::move(_gate));
+        start_(queue_size(), thread_count());
+    }
+
+private:
+    void start_(size_t queue_size, size_t thread_count)
+    {
+        _stats = std::make_shared<AsyncStats>(queue_size, thread_count);
+        _stats_sink = std::make_shared<async_stats_sink>(_stats);
+        _stamp_sink = std::make_shared<enqueue_stamp_sink>();
+
+        // wait for every worker to apply its settings, so failures are reported to the caller
+        struct startup_state {
+            std::mutex mutex;
+            std::condition_variable cv;
+            size_t started{ 0 };
+            int error{ 0 };
+        };
+        auto startup = std::make_shared<startup_state>();
+        auto stats = _stats;
+        auto cpu_affinity = _cpu_affinity;
+        auto nice = _nice;
+        _tp = std::make_shared<spd::details::thread_pool>(queue_size, thread_count, [stats, startup, cpu_affinity, nice] {
+            stats->on_worker_start();
+            int error = setup_worker_thread(cpu_affinity, nice);
+            std::lock_guard<std::mutex> lock(startup->mutex);
+            if (error != 0)
+                startup->error = error;
+            ++startup->started;
+            startup->cv.notify_all();
+        });
+        int error = 0;
+        {
+            std::unique_lock<std::mutex> lock(startup->mutex);
+            startup->cv.wait(lock, [&] { return startup->started == thread_count; });
+            error = startup->error;
+        }
+        if (error != 0) {
+            _tp.reset();
+            throw std::system_error(error, std::generic_category(), "could not set up the thread pool workers");
+        }
+        _stats->set_thread_pool(_tp);
+        _gate = std::make_shared<fork_gate>(_tp, thread_count);
+    }
+
+    const spd::async_overflow_policy _overflow_policy;
+    const std::vector<int> _cpu_affinity;
+    const int _nice;
+    std::atomic<bool> _has_python_sink{ false };
+    std::shared_ptr<AsyncStats> _stats;
+    spd::sink_ptr _stats_sink;
+    spd::sink_ptr _stamp_sink;
+    std::shared_ptr<spd::details::thread_pool> _tp;
+    std::shared_ptr<fork_gate> _gate;
+};
+
+// Sinks of an async spdlog logger. The worker runs them in this order: enqueue_stamp_sink
+// first, so no sink formats a message still carrying its enqueue stamp in color_range_start,
+// the user's sinks behind the fanout, then async_stats_sink once they wrote it.
+std::vector<spd::sink_ptr> async_sink_chain(const AsyncPool& pool, const spd::sink_ptr& fanout)
+{
+    return { pool.stamp_sink(), fanout, pool.stats_sink() };
+}
+
+// Pool used by loggers created in async mode without a pool of their own, guarded by the registry's tp mutex.
+std::shared_ptr<AsyncPool> g_async_pool;
+
+void set_async_mode(size_t queue_size = spdlog::details::default_async_q_size, size_t thread_count = 1, int async_overflow_policy = AsyncOverflowPolicy::block) {
+    // Initialize/replace the global spdlog thread pool.
+    // Loggers created before keep the pool they were created with.
+    // The new pool is started and the replaced one released outside the registry's lock, so
+    // concurrent calls and loggers being created only wait for the swap.
+    auto pool = std::make_shared<AsyncPool>(queue_size, thread_count, async_overflow_policy);
+    {
+        auto& registry = spdlog::details::registry::instance();
+        std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
+        registry.set_tp(pool->tp());
+        g_async_pool.swap(pool);
+        g_async_overflow_policy = static_cast<spd::async_overflow_policy>(async_overflow_policy);
+        g_async_mode_on = true;
+    }
+    // the last owner of the replaced pool joins its workers, which may wait for the GIL to reach a Python sink
+    py::gil_scoped_release release;
+    pool.reset();
+}
+
+std::shared_ptr<AsyncPool> async_pool() {
+    auto& registry = spdlog::details::registry::instance();
+    std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
+    if (g_async_pool == nullptr) {
+        g_async_pool = std::make_shared<AsyncPool>(spdlog::details::default_async_q_size, 1, (int)g_async_overflow_policy.load());
+        registry.set_tp(g_async_pool->tp());
+    }
+    return g_async_pool;
+}
+
+std::shared_ptr<AsyncStats> async_stats()
+{
+    return async_pool()->stats();
+}
+
+// Preallocated ring of the last records below a logger's level. Payloads are copied into fixed
+// slots of max_record_size bytes (longer ones are cut), so pushing never allocates.
+class BacktraceRing {
+public:
+    // The whole ring is allocated up front, so it is capped at 1 GiB.
+    static const size_t max_bytes = (size_t)1 << 30;
+
+    BacktraceRing(size_t size, size_t max_record_size)
+        : _entries(checked_size_(size, max_record_size))
+        , _max_record_size(max_record_size)
+        , _payloads(size * max_record_size)
+    {
+    }
+
+    void push(spd::level::level_enum level, spd::log_clock::time_point time, spd::string_view_t payload)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entry& e = _entries[_next];
+        e.level = level;
+        e.time = time;
+        e.size = std::min(payload.size(), _max_record_size);
+        std::memcpy(&_payloads[_next * _max_record_size], payload.data(), e.size);
+        _next = (_next + 1) % _entries.size();
+        _count = std::min(_count + 1, _entries.size());
+    }
+
+    // Copies the stored records out, oldest first, and empties the ring. The copies let the
+    // caller write them without holding the ring's mutex.
+    std::vector<spd::details::log_msg_buffer> take(spd::string_view_t logger_name)
+    {
+        std::vector<spd::details::log_msg_buffer> records;
+        std::lock_guard<std::mutex> lock(_mutex);
+        records.reserve(_count);
+        for (size_t i = (_next + _entries.size() - _count) % _entries.size(); _count > 0; i = (i + 1) % _entries.size(), --_count) {
+            const entry& e = _entries[i];
+            records.emplace_back(spd::details::log_msg(e.time, spd::source_loc{}, logger_name, e.level, spd::string_view_t(&_payloads[i * _max_record_size], e.size)));
+        }
+        return records;
+    }
+
+private:
+    struct entry {
+        spd::level::level_enum level;
+        spd::log_clock::time_point time;
+        size_t size;
+    };
+
+    static size_t checked_size_(size_t size, size_t max_record_size)
+    {
+        if (size == 0 || max_record_size == 0)
+            throw std::invalid_argument("backtrace size and max_record_size must be positive");
+        if (max_record_size > max_bytes - sizeof(entry) || size > max_bytes / (max_record_size + sizeof(entry)))
+            throw std::invalid_argument(fmt::format("backtrace of {} records of up to {} bytes exceeds 1 GiB", size, max_record_size));
+        return size;
+    }
+
+    std::mutex _mutex;
+    std::vector<entry> _entries;
+    const size_t _max_record_size;
+    std::vector<char> _payloads;
+    size_t _next{ 0 };
+    size_t _count{ 0 };
+};
+
+// The spdlog logger of a Logger and its thread pool, null for sync loggers. Replaced as a whole
+// after a fork and dropped by close(), callers work on the snapshot they loaded.
+struct LoggerCore {
+    std::shared_ptr<spd::logger> logger;
+    std::shared_ptr<AsyncPool> pool;
+};
+
+uint64_t drain_loggers(const std::vector<LoggerCore>& targets, double timeout)
+{
+    auto deadline = timeout < 0 ? std::chrono::steady_clock::time_point::max()
+                                : std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    py::gil_scoped_release release;
+    std::vector<AsyncPool*> pools;
+    uint64_t pending = 0;
+    for (const auto& target : targets) {
+        if (target.pool && std::find(pools.begin(), pools.end(), target.pool.get()) == pools.end()) {
+            pools.push_back(target.pool.get());
+            pending += target.pool->drain(deadline);
+        }
+    }
+    for (const auto& target : targets) {
+        if (!target.logger)
+            continue;
+        if (target.pool) {
+            // a flush of an async logger would only be queued, flush the sinks directly instead
+            for (const auto& sink : target.logger->sinks())
+                sink->flush();
+        } else {
+            target.logger->flush();
+        }
+    }
+    return pending;
+}
+
+class Logger {
+public:
+    // pool is the thread pool of an async logger, the global one is used when it is null.
+    Logger(const std::string& name, bool async_mode, std::shared_ptr<AsyncPool> pool = nullptr)
+        : _name(name)
+        , _async(async_mode)
+        , _release_gil(g_release_gil.load())
+        , _requested_pool(std::move(pool))
+    {
+        if (_requested_pool && !_async)
+            throw std::invalid_argument("a thread_pool can only be used in async mode");
+        std::lock_guard<std::mutex> lock(mutex_fork);
+        g_live_loggers.push_back(this);
+    }
+
+    virtual ~Logger()
+    {
+        erase_fork_entry(g_live_loggers, this);
+        remove_expired_logger(_name);
+    }
+
+    template <typename T, typename... Args>
+    friend std::shared_ptr<T> make_logger(Args... args);
+    std::string name() const
+    {
+        if (auto core = std::atomic_load(&_core))
+            return core->logger->name();
+        else
+            return "NULL";
+    }
+    // msg may be a str, bytes or any object supporting the buffer protocol, it is not copied before reaching the sinks.
+    void log(int level, py::handle msg) const { log_((spd::level::level_enum)level, msg); }
+    void trace(py::handle msg) const { log_(spd::level::trace, msg); }
+    void debug(py::handle msg) const { log_(spd::level::debug, msg); }
+    void info(py::handle msg) const { log_(spd::level::info, msg); }
+    void warn(py::handle msg) const { log_(spd::level::warn, msg); }
+    void error(py::handle msg) const { log_(spd::level::err, msg); }
+    void critical(py::handle msg) const { log_(spd::level::critical, msg); }
+
+    // Logs a batch of messages in one call. levels is a single level or an iterable with one level per message,
+    // timestamps is None or an iterable of seconds since the epoch (as returned by time.time()).
+    void log_many(py::handle levels, py::iterable messages, py::object timestamps) const
+    {
+        const bool single_level = PyLong_Check(levels.ptr());
+        const auto level = single_level ? (spd::level::level_enum)levels.cast<int>() : spd::level::off;
+        const auto core = core_();
+        if (single_level && !core->logger->should_log(level) && !_has_backtrace)
+            return;
+        const auto backtrace = backtrace_();
+        const auto filters = filters_();
+
+        py::iterator level_it = single_level ? py::iterator() : py::iter(levels);
+        py::iterator time_it = timestamps.is_none() ? py::iterator() : py::iter(timestamps);
+
+        std::vector<BatchRecord> batch;
+        bool dump = false;
+        Py_ssize_t length_hint = PyObject_LengthHint(messages.ptr(), 0);
+        if (length_hint < 0)
+            throw py::error_already_set();
+        batch.reserve((size_t)length_hint);
+        for (py::handle msg : messages) {
+            auto msg_level = level;
+            if (!single_level) {
+                if (level_it == py::iterator::sentinel())
+                    throw std::invalid_argument("log_many: fewer levels than messages");
+                msg_level = (spd::level::level_enum)(*level_it).cast<int>();
+                ++level_it;
+            }
+            auto time = spd::log_clock::time_point();
+            bool has_time = false;
+            if (time_it) {
+                if (time_it == py::iterator::sentinel())
+                    throw std::invalid_argument("log_many: fewer timestamps than messages");
+                double seconds = (*time_it).cast<double>();
+                time = spd::log_clock::time_point(std::chrono::duration_cast<spd::log_clock::duration>(std::chrono::duration<double>(seconds)));
+                has_time = true;
+                ++time_it;
+            }
+            if (core->logger->should_log(msg_level)) {
+                MessageView view(msg);
+                auto payload = view.view();
+                if (filters && !filter_(*core, *filters, msg_level, &payload, false))
+                    continue;
+                batch.push_back(BatchRecord{ msg_level, has_time, time, py::reinterpret_borrow<py::object>(msg), std::move(view) });
+                dump = dump || (backtrace && msg_level >= _backtrace_dump_level);
+            } else if (backtrace) {
+                backtrace->push(msg_level, has_time ? time : spd::log_clock::now(), MessageView(msg).view());
+            }
+        }
+
+        if (dump)
+            dump_backtrace_(*core, *backtrace);
+        py::object context;
+        const bound_context* bound = current_context(context);
+        count_enqueued_(*core, batch.size());
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            log_batch_(*core, batch, bound);
+        } else {
+            log_batch_(*core, batch, bound);
+        }
+    }
+
+    // Used by LoggingHandler, msg is logged with the time and source location of a stdlib logging record.
+    void log_record(spd::level::level_enum level, spd::log_clock::time_point time, spd::source_loc loc, py::handle msg) const
+    {
+        const auto core = core_();
+        if (!core->logger->should_log(level)) {
+            if (auto backtrace = backtrace_())
+                backtrace->push(level, time, MessageView(msg).view());
+            return;
+        }
+        const auto filters = filters_();
+        if (filters && !filter_(*core, *filters, level, nullptr, false))
+            return;
+        MessageView view(msg);
+        auto payload = view.view();
+        if (filters && !filter_(*core, *filters, level, &payload, true))
+            return;
+        maybe_dump_backtrace_(*core, level);
+        py::object context;
+        const bound_context* bound = current_context(context);
+        count_enqueued_(*core);
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            write_(*core, time, loc, level, payload, bound);
+        } else {
+            write_(*core, time, loc, level, payload, bound);
+        }
+    }
+
+    // fmt style formatting, only done when the level is enabled.
+    void log_fmt(int level, const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_((spd::level::level_enum)level, format, args, kwargs); }
+    void trace_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::trace, format, args, kwargs); }
+    void debug_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::debug, format, args, kwargs); }
+    void info_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::info, format, args, kwargs); }
+    void warn_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::warn, format, args, kwargs); }
+    void error_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::err, format, args, kwargs); }
+    void critical_fmt(const std::string& format, py::args args, py::kwargs kwargs) const { log_fmt_(spd::level::critical, format, args, kwargs); }
+
+    // Structured records, written as msg="..." key=value ... and as JSON objects by sinks using a JsonFormatter.
+    // Field values are serialized natively, None, bool, int and float as JSON literals and anything else as a string.
+    void log_kv(int level, py::handle msg, py::kwargs fields) const { log_kv_((spd::level::level_enum)level, msg, fields); }
+    void trace_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::trace, msg, fields); }
+    void debug_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::debug, msg, fields); }
+    void info_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::info, msg, fields); }
+    void warn_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::warn, msg, fields); }
+    void error_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::err, msg, fields); }
+    void critical_kv(py::handle msg, py::kwargs fields) const { log_kv_(spd::level::critical, msg, fields); }
+
+    bool should_log(int level) const
+    {
+        return core_()->logger->should_log((spd::level::level_enum)level);
+    }
+
+    // True when a call at level returns without looking at its arguments, see fast_path.
+    bool skips(spd::level::level_enum level) const
+    {
+        auto core = std::atomic_load(&_core);
+        return core && !core->logger->should_log(level) && !_has_backtrace;
+    }
+
+    void set_level(int level)
+    {
+        core_()->logger->set_level((spd::level::level_enum)level);
+    }
+
+    int level() const
+    {
+        return (int)core_()->logger->level();
+    }
+
+    void set_pattern(const std::string& pattern, spd::pattern_time_type type = spd::pattern_time_type::local)
+    {
+        core_()->logger->set_formatter(structured::make_pattern_formatter(pattern, type));
+    }
+
+    // automatically call flush() if message level >= log_level
+    void flush_on(int log_level)
+    {
+        core_()->logger->flush_on((spd::level::level_enum)log_level);
+    }
+
+    void flush()
+    {
+        const auto core = core_();
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            core->logger->flush();
+        } else {
+            core->logger->flush();
+        }
+    }
+
+    bool async() const
+    {
+        return _async;
+    }
+
+    // when enabled the GIL is released while the message is formatted and written to the sinks
+    void set_release_gil(bool release_gil)
+    {
+        _release_gil = release_gil;
+    }
+
+    bool release_gil() const
+    {
+        return _release_gil;
+    }
+
+    // Other handles of the logger raise RuntimeError once it is closed, threads logging at that
+    // moment finish with the spdlog logger they already loaded.
+    void close()
+    {
+        remove_logger(_name);
+        std::atomic_store(&_core, std::shared_ptr<const LoggerCore>());
+        spdlog::drop(_name);
+    }
+
+    std::vector<Sink> sinks() const
+    {
+        core_();
+        std::vector<Sink> snks;
+        for (const spd::sink_ptr& sink : *_fanout->sinks())
+            snks.push_back(Sink(sink));
+        return snks;
+    }
+
+    // The sink list can be changed while other threads log, records of an async logger still
+    // queued are written to the sinks attached when the worker gets to them. Added sinks keep
+    // their own pattern.
+    void add_sink(const Sink& sink)
+    {
+        prepare_sink_(*core_(), sink.get_sink());
+        _fanout->add(sink.get_sink());
+    }
+
+    bool remove_sink(const Sink& sink)
+    {
+        core_();
+        return _fanout->remove(sink.get_sink());
+    }
+
+    void replace_sinks(const std::vector<Sink>& sink_list)
+    {
+        const auto core = core_();
+        fanout_sink::sink_list sinks;
+        for (const auto& sink : sink_list) {
+            prepare_sink_(*core, sink.get_sink());
+            sinks.push_back(sink.get_sink());
+        }
+        _fanout->replace(std::move(sinks));
+    }
+
+    // statistics of the thread pool used by an async logger, None for sync loggers
+    std::shared_ptr<AsyncStats> async_stats() const
+    {
+        const auto core = core_();
+        return core->pool ? core->pool->stats() : nullptr;
+    }
+
+    void set_error_handler(spd::err_handler handler)
+    {
+        core_()->logger->set_error_handler(handler);
+        std::lock_guard<std::mutex> lock(_settings_mutex);
+        _error_handler = std::move(handler);
+    }
+
+    // null once the logger is closed
+    std::shared_ptr<spdlog::logger> get_underlying_logger() {
+        auto core = std::atomic_load(&_core);
+        return core ? core->logger : nullptr;
+    }
+
+    // Blocks until every message queued on this logger's thread pool before the call has been written
+    // and the sinks are flushed, or until timeout seconds passed (negative waits forever).
+    // Returns the number of messages still pending.
+    uint64_t drain(double timeout) const
+    {
+        return drain_loggers({ *core_() }, timeout);
+    }
+
+    // empty once the logger is closed
+    LoggerCore drain_target() const
+    {
+        auto core = std::atomic_load(&_core);
+        return core ? *core : LoggerCore{};
+    }
+
+    // In a forked child once the pools were restarted: an async logger is recreated on its pool's
+    // new workers, with the same sinks, levels and error handler.
+    void restart_after_fork()
+    {
+        auto core = std::atomic_load(&_core);
+        if (!_async || !core)
+            return;
+        const auto& old = core->logger;
+        const auto& pool = core->pool;
+        auto sinks = async_sink_chain(*pool, _fanout);
+        auto logger = std::make_shared<spd::async_logger>(_name, sinks.begin(), sinks.end(), pool->tp(), pool->overflow_policy());
+        logger->set_level(old->level());
+        logger->flush_on(old->flush_level());
+        if (_error_handler)
+            logger->set_error_handler(_error_handler);
+        auto& registry = spd::details::registry::instance();
+        if (registry.get(_name) == old) {
+            registry.drop(_name);
+            registry.register_logger(logger);
+        }
+        std::atomic_store(&_core, std::shared_ptr<const LoggerCore>(std::make_shared<LoggerCore>(LoggerCore{ logger, pool })));
+    }
+
+    // Keeps the last size records below the logger's level in a preallocated ring instead of
+    // dropping them. They are written once a record at dump_level or above is logged, or when
+    // dump_backtrace() is called. Payloads longer than max_record_size bytes are cut.
+    void enable_backtrace(size_t size, int dump_level, size_t max_record_size)
+    {
+        auto backtrace = std::make_shared<BacktraceRing>(size, max_record_size);
+        std::lock_guard<std::mutex> lock(_settings_mutex);
+        _backtrace_dump_level = (spd::level::level_enum)dump_level;
+        std::atomic_store(&_backtrace, std::move(backtrace));
+        _has_backtrace = true;
+    }
+
+    void disable_backtrace()
+    {
+        std::lock_guard<std::mutex> lock(_settings_mutex);
+        _has_backtrace = false;
+        std::atomic_store(&_backtrace, std::shared_ptr<BacktraceRing>());
+    }
+
+    void dump_backtrace() const
+    {
+        const auto core = core_();
+        auto backtrace = backtrace_();
+        if (!backtrace)
+            return;
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            dump_backtrace_(*core, *backtrace);
+        } else {
+            dump_backtrace_(*core, *backtrace);
+        }
+    }
+
+    // Filters run in the order they were added, after the level check and before the message
+    // is copied or queued.
+    void add_filter(std::shared_ptr<LogFilter> filter)
+    {
+        if (!filter)
+            throw std::invalid_argument("filter must not be None");
+        update_filters_([&](filter_list& filters) { filters.push_back(std::move(filter)); });
+    }
+
+    void remove_filter(const std::shared_ptr<LogFilter>& filter)
+    {
+        update_filters_([&](filter_list& filters) { filters.erase(std::remove(filters.begin(), filters.end(), filter), filters.end()); });
+    }
+
+    void clear_filters()
+    {
+        update_filters_([](filter_list& filters) { filters.clear(); });
+    }
+
+    filter_list filters() const
+    {
+        auto filters = filters_();
+        return filters ? *filters : filter_list();
+    }
+
+protected:
+    // Creates the spdlog logger, sync or async depending on the mode the logger was constructed with.
+    void init_(std::vector<spd::sink_ptr> user_sinks, bool register_in_spdlog = true)
+    {
+        auto core = std::make_shared<LoggerCore>();
+        if (_async)
+            core->pool = _requested_pool ? std::move(_requested_pool) : async_pool();
+        for (const auto& sink : user_sinks)
+            prepare_sink_(*core, sink);
+        _fanout = std::make_shared<fanout_sink>(std::move(user_sinks));
+        std::vector<spd::sink_ptr> sinks{ _fanout };
+        if (_async) {
+            sinks = async_sink_chain(*core->pool, _fanout);
+            core->logger = std::make_shared<spd::async_logger>(_name, sinks.begin(), sinks.end(), core->pool->tp(), core->pool->overflow_policy());
+        } else {
+            core->logger = std::make_shared<spd::logger>(_name, sinks.begin(), sinks.end());
+        }
+        if (register_in_spdlog)
+            spd::initialize_logger(core->logger);
+        std::atomic_store(&_core, std::shared_ptr<const LoggerCore>(std::move(core)));
+    }
+
+    // Snapshot of the spdlog logger and pool for one call, raises once the logger is closed.
+    std::shared_ptr<const LoggerCore> core_() const
+    {
+        auto core = std::atomic_load(&_core);
+        if (!core)
+            throw std::runtime_error("logger is closed");
+        return core;
+    }
+
+    void log_(spd::level::level_enum level, py::handle msg) const
+    {
+        const auto core = core_();
+        if (!core->logger->should_log(level)) {
+            if (auto backtrace = backtrace_())
+                backtrace->push(level, spd::log_clock::now(), MessageView(msg).view());
+            return;
+        }
+        const auto filters = filters_();
+        if (filters && !filter_(*core, *filters, level, nullptr, false))
+            return;
+        // the caller holds a reference to msg for the duration of the call, so the view stays valid without the GIL.
+        MessageView view(msg);
+        auto payload = view.view();
+        if (filters && !filter_(*core, *filters, level, &payload, true))
+            return;
+        maybe_dump_backtrace_(*core, level);
+        py::object context;
+        const bound_context* bound = current_context(context);
+        count_enqueued_(*core);
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            write_(*core, spd::source_loc{}, level, payload, bound);
+        } else {
+            write_(*core, spd::source_loc{}, level, payload, bound);
+        }
+    }
+
+    // The worker needs the GIL to deliver to a Python sink, so a caller blocked on a full
+    // queue must not hold it, whichever logger of the pool it logs to.
+    void prepare_sink_(const LoggerCore& core, const spd::sink_ptr& sink)
+    {
+        if (!sink)
+            throw std::invalid_argument("sink must not be None");
+        auto inner = sink;
+        if (auto filtered = std::dynamic_pointer_cast<filter_sink>(sink))
+            inner = filtered->inner();
+        if (core.pool && std::dynamic_pointer_cast<python_batch_sink>(inner))
+            core.pool->add_python_sink();
+    }
+
+    // The GIL is also released while the pool is parked for a fork: a caller blocked on its full
+    // queue must not hold it then, the forking thread needs it to go on.
+    bool release_gil_(const LoggerCore& core) const
+    {
+        return _release_gil || (core.pool && (core.pool->has_python_sink() || core.pool->gate()->closed()));
+    }
+
+    static void count_enqueued_(const LoggerCore& core, uint64_t count = 1)
+    {
+        if (core.pool)
+            core.pool->stats()->on_enqueue(count);
+    }
+
+    // Runs the filters applying to level, true when the record passes. Without a payload only the
+    // filters not looking at it run, with payload_only only those looking at it.
+    bool filter_(const LoggerCore& core, const filter_list& filters, spd::level::level_enum level, const spd::string_view_t* payload, bool payload_only) const
+    {
+        for (const auto& filter : filters) {
+            if (!filter->applies_to(level))
+                continue;
+            if (payload ? payload_only && !filter->needs_payload() : filter->needs_payload())
+                continue;
+            LogFilter::summary summary;
+            if (!filter->allow(level, payload ? *payload : spd::string_view_t(), summary))
+                return false;
+            if (summary.pending) {
+                count_enqueued_(core);
+                if (release_gil_(core)) {
+                    py::gil_scoped_release release;
+                    core.logger->log(summary.level, summary.text);
+                } else {
+                    core.logger->log(summary.level, summary.text);
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool needs_payload_(const filter_list& filters, spd::level::level_enum level)
+    {
+        for (const auto& filter : filters)
+            if (filter->applies_to(level) && filter->needs_payload())
+                return true;
+        return false;
+    }
+
+    void maybe_dump_backtrace_(const LoggerCore& core, spd::level::level_enum level) const
+    {
+        if (!_has_backtrace || level < _backtrace_dump_level)
+            return;
+        if (auto backtrace = backtrace_())
+            dump_backtrace_(core, *backtrace);
+    }
+
+    // Copies the filter list, applies update and publishes the copy, an empty list as none.
+    template <typename Update>
+    void update_filters_(const Update& update)
+    {
+        std::lock_guard<std::mutex> lock(_settings_mutex);
+        auto current = std::atomic_load(&_filters);
+        auto filters = current ? std::make_shared<filter_list>(*current) : std::make_shared<filter_list>();
+        update(*filters);
+        const bool any = !filters->empty();
+        std::atomic_store(&_filters, any ? std::shared_ptr<const filter_list>(std::move(filters)) : nullptr);
+        _has_filters = any;
+    }
+
+    // The ring and the filters can be replaced while other threads log, readers take a snapshot.
+    // The flags spare loggers without them the shared_ptr load.
+    std::shared_ptr<BacktraceRing> backtrace_() const
+    {
+        return _has_backtrace ? std::atomic_load(&_backtrace) : nullptr;
+    }
+
+    std::shared_ptr<const filter_list> filters_() const
+    {
+        return _has_filters ? std::atomic_load(&_filters) : nullptr;
+    }
+
+    // Replays the backtrace between start and end markers, like spdlog's dump_backtrace. The
+    // records go through a clone of the logger at trace level, which shares the sinks and the
+    // thread pool, so they stay in order with the rest. They carry the dumping thread's id.
+    void dump_backtrace_(const LoggerCore& core, BacktraceRing& backtrace) const
+    {
+        auto records = backtrace.take(_name);
+        if (records.empty())
+            return;
+        auto replay = core.logger->clone(_name);
+        replay->set_level(spd::level::trace);
+        count_enqueued_(core, records.size() + 2);
+        replay->log(spd::level::info, "****************** Backtrace Start ******************");
+        for (const auto& record : records)
+            log_at_(core, *replay, record.time, record.source, record.level, record.payload);
+        replay->log(spd::level::info, "****************** Backtrace End ********************");
+    }
+
+    // Holds a reference to the message: an iterator drops the previous item when it advances,
+    // and msg borrows the buffer of a str or bytes. Destroyed after msg, which it outlives.
+    struct BatchRecord {
+        spd::level::level_enum level;
+        bool has_time;
+        spd::log_clock::time_point time;
+        py::object obj;
+        MessageView msg;
+    };
+
+    void log_batch_(const LoggerCore& core, const std::vector<BatchRecord>& batch, const bound_context* bound) const
+    {
+        for (const auto& record : batch) {
+            if (record.has_time)
+                write_(core, record.time, spd::source_loc{}, record.level, record.msg.view(), bound);
+            else
+                write_(core, spd::source_loc{}, record.level, record.msg.view(), bound);
+        }
+    }
+
+    // Logs payload, as a structured record carrying the fields bound to the context when there are any.
+    static void write_(const LoggerCore& core, spd::source_loc loc, spd::level::level_enum level, spd::string_view_t payload, const bound_context* bound)
+    {
+        if (!bound) {
+            core.logger->log(loc, level, payload);
+            return;
+        }
+        spd::memory_buf_t buf;
+        structured::append_message(payload, buf);
+        buf.append(bound->fragment);
+        core.logger->log(structured::tag(), level, spd::string_view_t(buf.data(), buf.size()));
+    }
+
+    static void write_(const LoggerCore& core, spd::log_clock::time_point time, spd::source_loc loc, spd::level::level_enum level, spd::string_view_t payload, const bound_context* bound)
+    {
+        if (!bound) {
+            log_at_(core, *core.logger, time, loc, level, payload);
+            return;
+        }
+        spd::memory_buf_t buf;
+        structured::append_message(payload, buf);
+        buf.append(bound->fragment);
+        log_at_(core, *core.logger, time, structured::tag(), level, spd::string_view_t(buf.data(), buf.size()));
+    }
+
+    // Logs with a caller supplied time, stamped with the enqueue time when async for the queue latency.
+    static void log_at_(const LoggerCore& core, spd::logger& logger, spd::log_clock::time_point time, spd::source_loc loc, spd::level::level_enum level, spd::string_view_t payload)
+    {
+        if (core.pool)
+            stamped_log::log(logger, time, loc, level, payload);
+        else
+            logger.log(time, loc, level, payload);
+    }
+
+    void log_fmt_(spd::level::level_enum level, const std::string& format, const py::args& args, const py::kwargs& kwargs) const
+    {
+        const auto core = core_();
+        const bool enabled = core->logger->should_log(level);
+        const auto backtrace = backtrace_();
+        if (!enabled && !backtrace)
+            return;
+        const auto filters = enabled ? filters_() : nullptr;
+        if (filters && !filter_(*core, *filters, level, nullptr, false))
+            return;
+        format_arg_store store;
+        std::vector<py::object> keep_alive;
+        build_format_args(args, kwargs, store, keep_alive);
+        if (!enabled) {
+            spd::memory_buf_t buf;
+            fmt::vformat_to(fmt::appender(buf), format, store);
+            backtrace->push(level, spd::log_clock::now(), spd::string_view_t(buf.data(), buf.size()));
+            return;
+        }
+        if (filters && needs_payload_(*filters, level)) {
+            // filters looking at the message need it formatted first
+            spd::memory_buf_t buf;
+            fmt::vformat_to(fmt::appender(buf), format, store);
+            spd::string_view_t payload(buf.data(), buf.size());
+            if (!filter_(*core, *filters, level, &payload, true))
+                return;
+            maybe_dump_backtrace_(*core, level);
+            py::object context;
+            const bound_context* bound = current_context(context);
+            count_enqueued_(*core);
+            if (release_gil_(*core)) {
+                py::gil_scoped_release release;
+                write_(*core, spd::source_loc{}, level, payload, bound);
+            } else {
+                write_(*core, spd::source_loc{}, level, payload, bound);
+            }
+            return;
+        }
+        maybe_dump_backtrace_(*core, level);
+        py::object context;
+        const bound_context* bound = current_context(context);
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            format_and_log_(*core, level, format, store, bound);
+        } else {
+            format_and_log_(*core, level, format, store, bound);
+        }
+    }
+
+    void log_kv_(spd::level::level_enum level, py::handle msg, const py::kwargs& fields) const
+    {
+        const auto core = core_();
+        const bool enabled = core->logger->should_log(level);
+        const auto backtrace = backtrace_();
+        if (!enabled && !backtrace)
+            return;
+        const auto filters = enabled ? filters_() : nullptr;
+        if (filters && !filter_(*core, *filters, level, nullptr, false))
+            return;
+        spd::memory_buf_t buf;
+        structured::append_message(MessageView(msg).view(), buf);
+        structured::append_fields(fields, buf);
+        py::object context;
+        if (const bound_context* bound = current_context(context))
+            buf.append(bound->fragment);
+        spd::string_view_t payload(buf.data(), buf.size());
+        if (!enabled) {
+            backtrace->push(level, spd::log_clock::now(), payload);
+            return;
+        }
+        if (filters && !filter_(*core, *filters, level, &payload, true))
+            return;
+        maybe_dump_backtrace_(*core, level);
+        count_enqueued_(*core);
+        if (release_gil_(*core)) {
+            py::gil_scoped_release release;
+            core->logger->log(structured::tag(), level, payload);
+        } else {
+            core->logger->log(structured::tag(), level, payload);
+        }
+    }
+
+    static void format_and_log_(const LoggerCore& core, spd::level::level_enum level, const std::string& format, const format_arg_store& store, const bound_context* bound)
+    {
+        spd::memory_buf_t buf;
+        fmt::vformat_to(fmt::appender(buf), format, store);
+        count_enqueued_(core);
+        write_(core, spd::source_loc{}, level, spd::string_view_t(buf.data(), buf.size()), bound);
+    }
+
+    const std::string _name;
+    bool _async;
+    std::atomic<bool> _release_gil;
+    // thread pool passed to the constructor, moved into the core by init_
+    std::shared_ptr<AsyncPool> _requested_pool;
+    // null once closed, read with std::atomic_load, see core_()
+    std::shared_ptr<const LoggerCore> _core;
+    std::shared_ptr<fanout_sink> _fanout;
+    // serializes changes of the backtrace ring, the filters and the error handler
+    std::mutex _settings_mutex;
+    std::shared_ptr<BacktraceRing> _backtrace;
+    std::atomic<bool> _has_backtrace{ false };
+    std::atomic<spd::level::level_enum> _backtrace_dump_level{ spd::level::err };
+    std::shared_ptr<const filter_list> _filters;
+    std::atomic<bool> _has_filters{ false };
+    // kept to be set again on the logger recreated after a fork
+    spd::err_handler _error_handler;
+};
+
+// Creates a Logger owned by its Python object and registers it for get(), drain() and drop().
+// Loggers constructed directly, like the benchmark ones, stay out of the registry.
+template <typename T, typename... Args>
+std::shared_ptr<T> make_logger(Args... args)
+{
+    auto logger = std::make_shared<T>(std::move(args)...);
+    register_logger(logger->_name, logger);
+    return logger;
+}
+
+class ConsoleLogger : public Logger {
+public:
+    ConsoleLogger(const std::string& logger_name, bool multithreaded, bool standard_out, bool colored, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        if (standard_out) {
+            if (multithreaded) {
+                if (colored)
+                    init_({ std::make_shared<spdlog::sinks::stdout_color_sink_mt>() });
+                else
+                    init_({ std::make_shared<spdlog::sinks::stdout_sink_mt>() });
+            } else {
+                if (colored)
+                    init_({ std::make_shared<spdlog::sinks::stdout_color_sink_st>() });
+                else
+                    init_({ std::make_shared<spdlog::sinks::stdout_sink_st>() });
+            }
+        } else {
+            if (multithreaded) {
+                if (colored)
+                    init_({ std::make_shared<spdlog::sinks::stderr_color_sink_mt>() });
+                else
+                    init_({ std::make_shared<spdlog::sinks::stderr_sink_mt>() });
+            } else {
+                if (colored)
+                    init_({ std::make_shared<spdlog::sinks::stderr_color_sink_st>() });
+                else
+                    init_({ std::make_shared<spdlog::sinks::stderr_sink_st>() });
+            }
+        }
+    }
+};
+
+class FileLogger : public Logger {
+public:
+    FileLogger(const std::string& logger_name, const std::string& filename, bool multithreaded, bool truncate = false, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        if (multithreaded)
+            init_({ std::make_shared<spdlog::sinks::basic_file_sink_mt>(filename, truncate) });
+        else
+            init_({ std::make_shared<spdlog::sinks::basic_file_sink_st>(filename, truncate) });
+    }
+};
+
+class RotatingLogger : public Logger {
+public:
+    RotatingLogger(const std::string& logger_name, const std::string& filename, bool multithreaded, size_t max_file_size, size_t max_files, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        if (multithreaded)
+            init_({ std::make_shared<spdlog::sinks::rotating_file_sink_mt>(filename, max_file_size, max_files) });
+        else
+            init_({ std::make_shared<spdlog::sinks::rotating_file_sink_st>(filename, max_file_size, max_files) });
+    }
+};
+
+class DailyLogger : public Logger {
+public:
+    DailyLogger(const std::string& logger_name, const std::string& filename, bool multithreaded = false, int hour = 0, int minute = 0, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        if (multithreaded)
+            init_({ std::make_shared<spdlog::sinks::daily_file_sink_mt>(filename, hour, minute) });
+        else
+            init_({ std::make_shared<spdlog::sinks::daily_file_sink_st>(filename, hour, minute) });
+    }
+};
+
+#ifdef SPDLOG_ENABLE_SYSLOG
+class SyslogLogger : public Logger {
+public:
+    SyslogLogger(const std::string& logger_name, bool multithreaded = false, const std::string& ident = "", int syslog_option = 0, int syslog_facilty = (1 << 3), bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        if (multithreaded)
+            init_({ std::make_shared<spdlog::sinks::syslog_sink_mt>(ident, syslog_option, syslog_facilty, false) });
+        else
+            init_({ std::make_shared<spdlog::sinks::syslog_sink_st>(ident, syslog_option, syslog_facilty, false) });
+    }
+};
+#endif
+
+// Default for loggers created afterwards, see Logger::set_release_gil.
+void set_release_gil(bool release_gil)
+{
+    g_release_gil = release_gil;
+}
+
+class SinkLogger : public Logger {
+public:
+    // SinkLoggers are not registered in the spdlog registry.
+    SinkLogger(const std::string& logger_name, const Sink& sink, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : SinkLogger(logger_name, std::vector<Sink>{ sink }, async_mode, std::move(pool))
+    {
+    }
+    SinkLogger(const std::string& logger_name, const std::vector<Sink>& sink_list, bool async_mode = g_async_mode_on, std::shared_ptr<AsyncPool> pool = nullptr)
+        : Logger(logger_name, async_mode, std::move(pool))
+    {
+        std::vector<spd::sink_ptr> sinks;
+        for (auto sink : sink_list)
+            sinks.push_back(sink.get_sink());
+        init_(sinks, false);
+    }
+};
+
+// logging.Handler subclass implemented natively, see bind_logging_handler.
+// Records are mapped onto spdlog messages without going through logging.Formatter.
+spd::level::level_enum level_from_logging(long levelno)
+{
+    if (levelno >= 50)
+        return spd::level::critical;
+    if (levelno >= 40)
+        return spd::level::err;
+    if (levelno >= 30)
+        return spd::level::warn;
+    if (levelno >= 20)
+        return spd::level::info;
+    if (levelno >= 10)
+        return spd::level::debug;
+    return spd::level::trace;
+}
+
+// record.getMessage() without the python call: str(msg) % args when args are given.
+py::object logging_record_message(py::handle record)
+{
+    py::object msg = record.attr("msg");
+    if (!PyUnicode_Check(msg.ptr()))
+        msg = py::str(msg);
+    py::object args = record.attr("args");
+    if (PyObject_IsTrue(args.ptr()) == 1) {
+        PyObject* formatted = PyUnicode_Format(msg.ptr(), args.ptr());
+        if (formatted == nullptr)
+            throw py::error_already_set();
+        msg = py::reinterpret_steal<py::object>(formatted);
+    }
+
+    // mirror logging.Formatter: append the traceback and the stack info if present
+    py::object exc_info = record.attr("exc_info");
+    py::object stack_info = record.attr("stack_info");
+    bool has_exc = PyObject_IsTrue(exc_info.ptr()) == 1;
+    bool has_stack = PyObject_IsTrue(stack_info.ptr()) == 1;
+    if (has_exc || has_stack) {
+        py::str text(msg);
+        if (has_exc) {
+            if (PyObject_IsTrue(record.attr("exc_text").ptr()) != 1) {
+                py::object lines = py::module_::import("traceback").attr("format_exception")(*exc_info);
+                py::str exc_text = py::str("").attr("join")(lines);
+                record.attr("exc_text") = exc_text.attr("rstrip")("\n");
+            }
+            text = py::str("{}\n{}").format(text, record.attr("exc_text"));
+        }
+        if (has_stack)
+            text = py::str("{}\n{}").format(text, stack_info);
+        msg = text;
+    }
+    return msg;
+}
+
+// File and function names of stdlib logging records queued on async loggers. Kept for the life
+// of the process, the code locations logging through a handler are few.
+std::mutex mutex_source_names;
+
+const char* source_name(py::handle name, bool interned)
+{
+    if (!PyUnicode_Check(name.ptr()))
+        return nullptr;
+    Py_ssize_t size = 0;
+    const char* data = PyUnicode_AsUTF8AndSize(name.ptr(), &size);
+    if (data == nullptr)
+        throw py::error_already_set();
+    if (!interned)
+        return data;
+    static auto* names = new std::unordered_set<std::string>();
+    std::lock_guard<std::mutex> lock(mutex_source_names);
+    return names->emplace(data, (size_t)size).first->c_str();
+}
+
+void logging_handler_init(py::object self, py::object logger, int level)
+{
+    py::module_::import("logging").attr("Handler").attr("__init__")(self, level);
+    logger.cast<Logger&>();
+    self.attr("spdlog_logger") = logger;
+}
+
+// logging.Handler.handleError reports the exception found in sys.exc_info()
+void logging_handler_error(py::object& self, py::object& record, py::error_already_set& e)
+{
+    PyObject *type, *value, *traceback;
+    PyErr_GetExcInfo(&type, &value, &traceback);
+    PyErr_SetExcInfo(e.type().inc_ref().ptr(), e.value().inc_ref().ptr(), e.trace().inc_ref().ptr());
+    self.attr("handleError")(record);
+    PyErr_SetExcInfo(type, value, traceback);
+}
+
+void logging_handler_emit(py::object self, py::object record)
+{
+    try {
+        const Logger& logger = self.attr("spdlog_logger").cast<const Logger&>();
+        auto level = level_from_logging(record.attr("levelno").cast<long>());
+        if (!logger.should_log((int)level))
+            return;
+
+        py::object msg = logging_record_message(record);
+        auto created = std::chrono::duration<double>(record.attr("created").cast<double>());
+        auto time = spd::log_clock::time_point(std::chrono::duration_cast<spd::log_clock::duration>(created));
+        // log_msg_buffer copies neither name: a sync logger formats them before the record goes
+        // away, an async one only later on its worker, so it gets interned copies
+        py::object pathname = record.attr("pathname");
+        py::object func_name = record.attr("funcName");
+        spd::source_loc loc{
+            source_name(pathname, logger.async()),
+            record.attr("lineno").cast<int>(),
+            source_name(func_name, logger.async())
+        };
+        logger.log_record(level, time, loc, msg);
+    } catch (py::error_already_set& e) {
+        logging_handler_error(self, record, e);
+    } catch (const std::exception& e) {
+        // C++ errors, such as a closed logger, become the Python exception pybind11 would raise
+        auto builtin = dynamic_cast<const py::builtin_exception*>(&e);
+        if (builtin != nullptr)
+            builtin->set_error();
+        else
+            PyErr_SetString(dynamic_cast<const std::invalid_argument*>(&e) ? PyExc_ValueError : PyExc_RuntimeError, e.what());
+        py::error_already_set error;
+        logging_handler_error(self, record, error);
+    }
+}
+
+void bind_logging_handler(py::module_& m)
+{
+    py::object handler_base = py::module_::import("logging").attr("Handler");
+    py::object py_type = py::reinterpret_borrow<py::object>((PyObject*)&PyType_Type);
+    py::dict ns;
+    ns["__module__"] = "spdlog";
+    ns["__doc__"] = "logging.Handler that writes stdlib logging records to a spdlog Logger";
+    py::object cls = py_type("LoggingHandler", py::make_tuple(handler_base), ns);
+    cls.attr("__init__") = py::cpp_function(logging_handler_init, py::name("__init__"), py::is_method(cls),
+        py::arg("self"), py::arg("logger"), py::arg("level") = 0);
+    cls.attr("emit") = py::cpp_function(logging_handler_emit, py::name("emit"), py::is_method(cls),
+        py::arg("self"), py::arg("record"));
+    m.attr("LoggingHandler") = cls;
+}
+
+// Returns the registered Logger itself, pybind11 hands back the existing Python object, so
+// every caller shares one handle and sees close() and set_level() done through any of them.
+std::shared_ptr<Logger> get(const std::string& name)
+{
+    auto logger = access_logger(name);
+    if (logger)
+        return logger;
+    else
+        throw std::runtime_error(std::string("Logger name: " + name + " could not be found"));
+}
+
+void drop(const std::string& name)
+{
+    remove_logger(name);
+    spdlog::drop(name);
+}
+
+void drop_all()
+{
+    remove_logger_all();
+    spdlog::drop_all();
+}
+
+uint64_t drain(double timeout)
+{
+    std::vector<LoggerCore> targets;
+    for (const auto& logger : access_logger_all())
+        targets.push_back(logger->drain_target());
+    return drain_loggers(targets, timeout);
+}
+
+// interval of flush_every, restarted after a fork
+std::atomic<double> g_flush_every_seconds{ 0 };
+
+// Periodic flush of every logger registered in spdlog by spdlog's own worker thread;
+// 0 stops it. SinkLoggers are not registered, use Sink.set_flush_policy for them.
+void flush_every(double seconds)
+{
+    if (seconds < 0)
+        throw std::invalid_argument("seconds must not be negative");
+    spdlog::flush_every(std::chrono::milliseconds((int64_t)(seconds * 1000)));
+    g_flush_every_seconds = seconds;
+}
+
+// Drains every logger, then drops them and the global thread pool. Registered with atexit.
+uint64_t shutdown_loggers(double timeout)
+{
+    uint64_t pending = drain(timeout);
+    drop_all();
+    // released after the lock, joining the workers may wait for the GIL
+    std::shared_ptr<AsyncPool> pool;
+    auto& registry = spdlog::details::registry::instance();
+    std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
+    registry.set_tp(nullptr);
+    g_async_pool.swap(pool);
+    return pending;
+}
+
 
-    Logger(const std::string& name, bool async_mode)
-        : _name(name)
-        , _async(async_mode)
-    {
-        register_logger(name, this);
-    }
+#ifndef _WIN32
+// Fork hooks. Before the fork the workers of every pool are parked at their gate and the sinks
+// flushed, so the child inherits neither a sink in the middle of a write nor buffered output it
+// would write a second time. The parent then lets its workers go on. The child, which has none
+// of them, restarts every pool and moves the async loggers to the new workers. Records still
+// queued at the fork are written by the parent only.
+const std::chrono::seconds fork_pause_timeout(5);
+std::vector<std::shared_ptr<fork_gate>> g_paused_gates;
+// Set by before_fork: the pthread_atfork handlers only lock for forks made through os.fork, not
+// for the fork of subprocess or other native code, whose child runs no Python.
+std::atomic<bool> g_forking{ false };
+bool g_fork_locked = false;
 
-    virtual ~Logger() {}
-    std::string name() const
-    {
-        if (_logger)
-            return _logger->name();
-        else
-            return "NULL";
-    }
-    void log(int level, const std::string& msg) const { this->_logger->log((spd::level::level_enum)level, msg); }
-    void trace(const std::string& msg) const { this->_logger->trace(msg); }
-    void debug(const std::string& msg) const { this->_logger->debug(msg); }
-    void info(const std::string& msg) const { this->_logger->info(msg); }
-    void warn(const std::string& msg) const { this->_logger->warn(msg); }
-    void error(const std::string& msg) const { this->_logger->error(msg); }
-    void critical(const std::string& msg) const { this->_logger->critical(msg); }
+void restart_flusher()
+{
+    const double seconds = g_flush_every_seconds;
+    if (seconds > 0)
+        spdlog::flush_every(std::chrono::milliseconds((int64_t)(seconds * 1000)));
+}
 
-    bool should_log(int level) const
+void before_fork()
+{
+    g_forking = true;
+    std::vector<std::shared_ptr<spd::logger>> loggers;
     {
-        return _logger->should_log((spd::level::level_enum)level);
+        std::lock_guard<std::mutex> lock(mutex_fork);
+        for (AsyncPool* pool : g_pools)
+            g_paused_gates.push_back(pool->gate());
+        for (Logger* logger : g_live_loggers)
+            if (auto underlying = logger->get_underlying_logger())
+                loggers.push_back(std::move(underlying));
     }
-
-    void set_level(int level)
+    for (const auto& gate : g_paused_gates)
+        gate->close();
+    bool paused = true;
     {
-        _logger->set_level((spd::level::level_enum)level);
+        py::gil_scoped_release release;
+        // the periodic flusher could be blocked queueing a flush on a paused pool
+        if (g_flush_every_seconds > 0)
+            spdlog::flush_every(std::chrono::seconds(0));
+        const auto deadline = std::chrono::steady_clock::now() + fork_pause_timeout;
+        for (const auto& gate : g_paused_gates)
+            paused = gate->pause(deadline) && paused;
+        for (const auto& logger : loggers)
+            for (const auto& sink : logger->sinks())
+                sink->flush();
     }
+    // The gates stay closed until after the fork, a worker that did not stop is still in a sink
+    // and lock_for_fork waits for that sink.
+    if (!paused && PyErr_WarnEx(PyExc_RuntimeWarning, "spdlog: an async logging thread did not stop before fork", 1) < 0)
+        throw py::error_already_set();
+}
 
-    int level() const
-    {
-        return (int)_logger->level();
-    }
+void after_fork_in_parent()
+{
+    g_forking = false;
+    for (const auto& gate : g_paused_gates)
+        gate->resume();
+    g_paused_gates.clear();
+    restart_flusher();
+}
 
-    void set_pattern(const std::string& pattern, spd::pattern_time_type type = spd::pattern_time_type::local)
+void after_fork_in_child()
+{
+    g_forking = false;
+    for (auto& gate : g_paused_gates)
+        abandoned_after_fork().push_back(std::move(gate));
+    g_paused_gates.clear();
     {
-        _logger->set_pattern(pattern, type);
+        std::lock_guard<std::mutex> lock(mutex_fork);
+        for (AsyncPool* pool : g_pools)
+            pool->restart_after_fork();
+        for (Logger* logger : g_live_loggers)
+            logger->restart_after_fork();
+        for (fork_thread_owner* owner : g_thread_owners)
+            owner->restart_after_fork();
     }
-
-    // automatically call flush() if message level >= log_level
-    void flush_on(int log_level)
     {
-        _logger->flush_on((spd::level::level_enum)log_level);
+        auto& registry = spdlog::details::registry::instance();
+        std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
+        if (g_async_pool)
+            registry.set_tp(g_async_pool->tp());
     }
+    restart_flusher();
+}
 
-    void flush()
-    {
-        _logger->flush();
-    }
+struct base_sink_mutex : spd::sinks::base_sink<std::mutex> {
+    static std::mutex& of(spd::sinks::base_sink<std::mutex>& sink) { return sink.*(&base_sink_mutex::mutex_); }
+};
 
-    bool async()
-    {
-        return _async;
-    }
+// The registry's locks are private. An explicit instantiation may name private members, so
+// member_of(registry_map_mutex()) reads the pointer to logger_map_mutex_.
+template <typename Tag, typename Tag::type Member>
+struct member_access {
+    friend typename Tag::type member_of(Tag) { return Member; }
+};
+struct registry_map_mutex {
+    typedef std::mutex spd::details::registry::*type;
+    friend type member_of(registry_map_mutex);
+};
+struct registry_flusher_mutex {
+    typedef std::mutex spd::details::registry::*type;
+    friend type member_of(registry_flusher_mutex);
+};
+template struct member_access<registry_map_mutex, &spd::details::registry::logger_map_mutex_>;
+template struct member_access<registry_flusher_mutex, &spd::details::registry::flusher_mutex_>;
 
-    void close()
-    {
-        remove_logger(_name);
-        _logger = nullptr;
-        spdlog::drop(_name);
-    }
+// sink mutexes held across the fork, with their sinks kept alive until they are unlocked
+std::vector<std::pair<spd::sink_ptr, std::mutex*>> g_fork_locked_sinks;
 
-    std::vector<Sink> sinks() const
-    {
-        std::vector<Sink> snks;
-        for (const spd::sink_ptr& sink : _logger->sinks()) {
-            snks.push_back(Sink(sink));
-        }
-        return snks;
+void collect_sink_mutexes(const spd::sink_ptr& sink, std::vector<std::pair<spd::sink_ptr, std::mutex*>>& mutexes)
+{
+    std::mutex* mutex = nullptr;
+    if (auto fanout = std::dynamic_pointer_cast<fanout_sink>(sink)) {
+        for (const auto& inner : *fanout->sinks())
+            collect_sink_mutexes(inner, mutexes);
+    } else if (auto filtered = std::dynamic_pointer_cast<filter_sink>(sink)) {
+        collect_sink_mutexes(filtered->inner(), mutexes);
+    } else if (auto policy = std::dynamic_pointer_cast<flush_policy_sink>(sink)) {
+        mutex = &policy->mutex();
+        collect_sink_mutexes(policy->inner(), mutexes);
+    } else if (auto batch = std::dynamic_pointer_cast<python_batch_sink>(sink)) {
+        mutex = &batch->mutex();
+    } else if (auto base = std::dynamic_pointer_cast<spd::sinks::base_sink<std::mutex>>(sink)) {
+        mutex = &base_sink_mutex::of(*base);
     }
+    if (!mutex)
+        return;
+    for (const auto& entry : mutexes)
+        if (entry.second == mutex)
+            return;
+    mutexes.emplace_back(sink, mutex);
+}
 
-    void set_error_handler(spd::err_handler handler)
-    {
-        _logger->set_error_handler(handler);
+// A sink blocked on the GIL, which the forking thread holds, would never let go of its mutex.
+bool lock_until(std::mutex& mutex, std::chrono::steady_clock::time_point deadline)
+{
+    while (!mutex.try_lock()) {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    return true;
+}
 
-    std::shared_ptr<spdlog::logger> get_underlying_logger() {
-        return _logger;
-    }
+// pthread_atfork handlers: the module's and spdlog's registry locks are held across the fork, so
+// the child never inherits one held by a thread that does not exist there. The sinks of every
+// live logger and thread owner, the console and the thread owners' own locks are taken too, so
+// a worker that did not park at its gate is not forked in the middle of a write. They all share
+// one deadline.
+void lock_for_fork()
+{
+    if (!g_forking)
+        return;
+    auto& registry = spdlog::details::registry::instance();
+    registry.tp_mutex().lock();
+    (registry.*member_of(registry_map_mutex())).lock();
+    (registry.*member_of(registry_flusher_mutex())).lock();
+    mutex_loggers.lock();
+    mutex_fork.lock();
+    mutex_source_names.lock();
+    g_fork_locked = true;
+    std::vector<std::pair<spd::sink_ptr, std::mutex*>> mutexes;
+    for (Logger* logger : g_live_loggers)
+        if (auto underlying = logger->get_underlying_logger())
+            for (const auto& sink : underlying->sinks())
+                collect_sink_mutexes(sink, mutexes);
+    for (fork_thread_owner* owner : g_thread_owners)
+        for (const auto& sink : owner->fork_sinks())
+            collect_sink_mutexes(sink, mutexes);
+    mutexes.emplace_back(nullptr, &spd::details::console_mutex::mutex());
+    for (fork_thread_owner* owner : g_thread_owners)
+        if (std::mutex* mutex = owner->fork_mutex())
+            mutexes.emplace_back(nullptr, mutex);
+    const auto deadline = std::chrono::steady_clock::now() + fork_pause_timeout;
+    for (auto& entry : mutexes)
+        if (lock_until(*entry.second, deadline))
+            g_fork_locked_sinks.push_back(std::move(entry));
+}
 
-protected:
-    const std::string _name;
-    bool _async;
-    std::shared_ptr<spdlog::logger> _logger{ nullptr };
-};
+void unlock_after_fork()
+{
+    if (!g_fork_locked)
+        return;
+    g_fork_locked = false;
+    for (auto it = g_fork_locked_sinks.rbegin(); it != g_fork_locked_sinks.rend(); ++it)
+        it->second->unlock();
+    g_fork_locked_sinks.clear();
+    mutex_source_names.unlock();
+    mutex_fork.unlock();
+    mutex_loggers.unlock();
+    auto& registry = spdlog::details::registry::instance();
+    (registry.*member_of(registry_flusher_mutex())).unlock();
+    (registry.*member_of(registry_map_mutex())).unlock();
+    registry.tp_mutex().unlock();
+}
+#endif
 
-class ConsoleLogger : public Logger {
-public:
-    ConsoleLogger(const std::string& logger_name, bool multithreaded, bool standard_out, bool colored, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
-    {
-        if (standard_out) {
-            if (multithreaded) {
-                if (colored) {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stdout_color_mt<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stdout_color_mt<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stdout_color_mt(logger_name);
-                    }
-                } else {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stdout_logger_mt<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stdout_logger_mt<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stdout_logger_mt(logger_name);
-                    }
-                }
-            } else {
-                if (colored) {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stdout_color_st<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stdout_color_st<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stdout_color_st(logger_name);
-                    }
-                } else {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stdout_logger_st<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stdout_logger_st<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stdout_logger_st(logger_name);
-                    }
-                }
-            }
+#if PY_VERSION_HEX >= 0x03070000
+// The level methods of Logger as native fast-call methods installed over the pybind11
+// overloads. A call at a disabled level returns after one atomic load, before pybind11
+// dispatch or any argument conversion. A single message goes straight to Logger::log,
+// fmt style and invalid calls are handed to the pybind11 overloads.
+namespace fast_path {
 
-        } else {
-            if (multithreaded) {
-                if (colored) {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stderr_color_mt<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stderr_color_mt<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stderr_color_mt(logger_name);
-                    }
-                } else {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stderr_logger_mt<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stderr_logger_mt<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stderr_logger_mt(logger_name);
-                    }
-                }
-            } else {
-                if (colored) {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stderr_color_st<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stderr_color_st<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stderr_color_st(logger_name);
-                    }
-                } else {
-                    if (async_mode) {
-                        if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                            _logger = spd::stderr_logger_st<async_factory_nb>(logger_name);
-                        } else {
-                            _logger = spd::stderr_logger_st<spdlog::async_factory>(logger_name);
-                        }
-                    } else {
-                        _logger = spd::stderr_logger_st(logger_name);
-                    }
-                }
-            }
+    // trace .. critical, then log
+    const int log_method = spd::level::critical + 1;
+    PyObject* g_overloads[log_method + 1];
+
+    // null when self is not an initialized Logger, the overloads then raise the usual TypeError
+    Logger* logger_of(PyObject* self)
+    {
+        try {
+            return py::cast<Logger*>(py::handle(self));
+        } catch (const py::cast_error&) {
+            return nullptr;
         }
     }
-};
 
-class FileLogger : public Logger {
-public:
-    FileLogger(const std::string& logger_name, const std::string& filename, bool multithreaded, bool truncate = false, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
+    // True when the arguments certainly bind to one of the overloads, either the message alone
+    // or a str format. Anything else is forwarded, so a disabled level raises the same TypeError.
+    bool binds(PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames)
     {
-        if (multithreaded) {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::basic_logger_mt<async_factory_nb>(logger_name, filename, truncate);
-                } else {
-                    _logger = spd::basic_logger_mt<spdlog::async_factory>(logger_name, filename, truncate);
-                }
-            } else {
-                _logger = spd::basic_logger_mt(logger_name, filename, truncate);
-            }
-        } else {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::basic_logger_st<async_factory_nb>(logger_name, filename, truncate);
-                } else {
-                    _logger = spd::basic_logger_st<spdlog::async_factory>(logger_name, filename, truncate);
-                }
-            } else {
-                _logger = spd::basic_logger_st(logger_name, filename, truncate);
-            }
-        }
+        return nargs >= 1 && ((nargs == 1 && !kwnames) || PyUnicode_Check(args[0]));
     }
-};
 
-class RotatingLogger : public Logger {
-public:
-    RotatingLogger(const std::string& logger_name, const std::string& filename, bool multithreaded, size_t max_file_size, size_t max_files, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
+    // The mapping pybind11 applies to the exceptions thrown by this module.
+    void set_error()
     {
-        if (multithreaded) {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::rotating_logger_mt<async_factory_nb>(logger_name, filename, max_file_size, max_files);
-                } else {
-                    _logger = spd::rotating_logger_mt<spdlog::async_factory>(logger_name, filename, max_file_size, max_files);
-                }
-            } else {
-                _logger = spd::rotating_logger_mt(logger_name, filename, max_file_size, max_files);
-            }
-        } else {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::rotating_logger_st<async_factory_nb>(logger_name, filename, max_file_size, max_files);
-                } else {
-                    _logger = spd::rotating_logger_st<spdlog::async_factory>(logger_name, filename, max_file_size, max_files);
-                }
-            } else {
-                _logger = spd::rotating_logger_st(logger_name, filename, max_file_size, max_files);
-            }
+        try {
+            throw;
+        } catch (py::error_already_set& e) {
+            e.restore();
+        } catch (const std::bad_alloc&) {
+            PyErr_NoMemory();
+        } catch (const std::invalid_argument& e) {
+            PyErr_SetString(PyExc_ValueError, e.what());
+        } catch (const std::out_of_range& e) {
+            PyErr_SetString(PyExc_IndexError, e.what());
+        } catch (const std::exception& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+        } catch (...) {
+            PyErr_SetString(PyExc_RuntimeError, "Caught an unknown exception!");
         }
     }
-};
 
-class DailyLogger : public Logger {
-public:
-    DailyLogger(const std::string& logger_name, const std::string& filename, bool multithreaded = false, int hour = 0, int minute = 0, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
+    PyObject* forward(int method, PyObject* self, PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames)
     {
-        if (multithreaded) {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::daily_logger_mt<async_factory_nb>(logger_name, filename, hour, minute);
-                } else {
-                    _logger = spd::daily_logger_mt<spdlog::async_factory>(logger_name, filename, hour, minute);
-                }
-            } else {
-                _logger = spd::daily_logger_mt(logger_name, filename, hour, minute);
-            }
-        } else {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::daily_logger_st<async_factory_nb>(logger_name, filename, hour, minute);
-                } else {
-                    _logger = spd::daily_logger_st<spdlog::async_factory>(logger_name, filename, hour, minute);
-                }
-            } else {
-                _logger = spd::daily_logger_st(logger_name, filename, hour, minute);
-            }
+        const Py_ssize_t nkwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+#if PY_VERSION_HEX >= 0x03090000
+        std::vector<PyObject*> stack(1 + nargs + nkwargs);
+        stack[0] = self;
+        std::copy(args, args + nargs + nkwargs, stack.begin() + 1);
+        return PyObject_Vectorcall(g_overloads[method], stack.data(), (size_t)(1 + nargs), kwnames);
+#else
+        py::object positional = py::reinterpret_steal<py::object>(PyTuple_New(1 + nargs));
+        if (!positional)
+            return nullptr;
+        Py_INCREF(self);
+        PyTuple_SET_ITEM(positional.ptr(), 0, self);
+        for (Py_ssize_t i = 0; i < nargs; ++i) {
+            Py_INCREF(args[i]);
+            PyTuple_SET_ITEM(positional.ptr(), 1 + i, args[i]);
+        }
+        py::object keywords;
+        if (nkwargs > 0) {
+            keywords = py::reinterpret_steal<py::object>(PyDict_New());
+            if (!keywords)
+                return nullptr;
+            for (Py_ssize_t i = 0; i < nkwargs; ++i)
+                if (PyDict_SetItem(keywords.ptr(), PyTuple_GET_ITEM(kwnames, i), args[nargs + i]) < 0)
+                    return nullptr;
         }
+        return PyObject_Call(g_overloads[method], positional.ptr(), keywords.ptr());
+#endif
     }
-};
 
-#ifdef SPDLOG_ENABLE_SYSLOG
-class SyslogLogger : public Logger {
-public:
-    SyslogLogger(const std::string& logger_name, bool multithreaded = false, const std::string& ident = "", int syslog_option = 0, int syslog_facilty = (1 << 3), bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
+    template <int Level>
+    PyObject* level_method(PyObject* self, PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames)
     {
-        if (multithreaded) {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::syslog_logger_mt<async_factory_nb>(logger_name, ident, syslog_option, syslog_facilty);
-                } else {
-                    _logger = spd::syslog_logger_mt<spdlog::async_factory>(logger_name, ident, syslog_option, syslog_facilty);
-                }
-            } else {
-                _logger = spd::syslog_logger_mt(logger_name, ident, syslog_option, syslog_facilty);
-            }
-        } else {
-            if (async_mode) {
-                if (g_async_overflow_policy == spdlog::async_overflow_policy::overrun_oldest) {
-                    _logger = spd::syslog_logger_st<async_factory_nb>(logger_name, ident, syslog_option, syslog_facilty);
-                } else {
-                    _logger = spd::syslog_logger_st<spdlog::async_factory>(logger_name, ident, syslog_option, syslog_facilty);
-                }
-            } else {
-                _logger = spd::syslog_logger_st(logger_name, ident, syslog_option, syslog_facilty);
-            }
+        Logger* logger = logger_of(self);
+        if (!logger || !binds(args, nargs, kwnames))
+            return forward(Level, self, args, nargs, kwnames);
+        if (logger->skips((spd::level::level_enum)Level))
+            Py_RETURN_NONE;
+        if (nargs != 1 || kwnames)
+            return forward(Level, self, args, nargs, kwnames);
+        try {
+            logger->log(Level, args[0]);
+        } catch (...) {
+            set_error();
+            return nullptr;
         }
+        Py_RETURN_NONE;
     }
-};
-#endif
 
-class AsyncOverflowPolicy {
-public:
-    const static int block{ (int)spd::async_overflow_policy::block };
-    const static int overrun_oldest{ (int)spd::async_overflow_policy::overrun_oldest };
-};
+    PyObject* log(PyObject* self, PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames)
+    {
+        Logger* logger = logger_of(self);
+        if (!logger || nargs < 1 || !PyLong_CheckExact(args[0]) || !binds(args + 1, nargs - 1, kwnames))
+            return forward(log_method, self, args, nargs, kwnames);
+        long level = PyLong_AsLong(args[0]);
+        if (level < spd::level::trace || level > spd::level::critical) {
+            PyErr_Clear();
+            return forward(log_method, self, args, nargs, kwnames);
+        }
+        if (logger->skips((spd::level::level_enum)level))
+            Py_RETURN_NONE;
+        if (nargs != 2 || kwnames)
+            return forward(log_method, self, args, nargs, kwnames);
+        try {
+            logger->log((int)level, args[1]);
+        } catch (...) {
+            set_error();
+            return nullptr;
+        }
+        Py_RETURN_NONE;
+    }
 
-void set_async_mode(size_t queue_size = spdlog::details::default_async_q_size, size_t thread_count = 1, int async_overflow_policy = AsyncOverflowPolicy::block) {
-    // Initialize/replace the global spdlog thread pool.
-    auto& registry = spdlog::details::registry::instance();
-    std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
-    auto tp = std::make_shared<spd::details::thread_pool>(queue_size, thread_count);
-    registry.set_tp(tp);
+#define SPDLOG_PYTHON_FAST_METHOD(name, function, doc) \
+    { name, (PyCFunction)(void (*)(void))function, METH_FASTCALL | METH_KEYWORDS, doc }
 
-    g_async_overflow_policy = static_cast<spd::async_overflow_policy>(async_overflow_policy);
-    g_async_mode_on = true;
-}
+    PyMethodDef g_methods[] = {
+        SPDLOG_PYTHON_FAST_METHOD("trace", level_method<spd::level::trace>, "trace(msg) or trace(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("debug", level_method<spd::level::debug>, "debug(msg) or debug(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("info", level_method<spd::level::info>, "info(msg) or info(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("warn", level_method<spd::level::warn>, "warn(msg) or warn(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("error", level_method<spd::level::err>, "error(msg) or error(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("critical", level_method<spd::level::critical>, "critical(msg) or critical(format, *args, **kwargs)"),
+        SPDLOG_PYTHON_FAST_METHOD("log", log, "log(level, msg) or log(level, format, *args, **kwargs)"),
+    };
+#undef SPDLOG_PYTHON_FAST_METHOD
 
-std::shared_ptr<spdlog::details::thread_pool> thread_pool() {
-    auto& registry = spdlog::details::registry::instance();
-    std::lock_guard<std::recursive_mutex> tp_lck(registry.tp_mutex());
-    auto tp = registry.get_tp();
-    if(tp == nullptr) {
-        set_async_mode();
-        auto tp = registry.get_tp();
+    // Replaces the methods of cls (the Logger class), keeping the pybind11 overloads to forward to.
+    void install(const py::object& cls)
+    {
+        for (int method = 0; method <= log_method; ++method) {
+            PyMethodDef& def = g_methods[method];
+            PyObject* overloads = PyDict_GetItemString(reinterpret_cast<PyTypeObject*>(cls.ptr())->tp_dict, def.ml_name);
+            if (overloads == nullptr)
+                throw std::logic_error(std::string("Logger has no method ") + def.ml_name);
+            if (PyInstanceMethod_Check(overloads))
+                overloads = PyInstanceMethod_GET_FUNCTION(overloads);
+            Py_INCREF(overloads);
+            g_overloads[method] = overloads;
+            auto descriptor = py::reinterpret_steal<py::object>(PyDescr_NewMethod(reinterpret_cast<PyTypeObject*>(cls.ptr()), &def));
+            if (!descriptor || PyObject_SetAttrString(cls.ptr(), def.ml_name, descriptor.ptr()) < 0)
+                throw py::error_already_set();
+        }
     }
 
-    return tp;
-}
+} // namespace fast_path
+#endif
 
-class SinkLogger : public Logger {
+// Layer benchmark of tests/binding_overhead.py, built with SPDLOG_PYTHON_BENCHMARKS=1.
+#ifdef SPDLOG_PYTHON_BENCHMARKS
+// Formats every record into a scratch buffer and drops it, the cost of a sink minus its I/O.
+class format_only_sink : public spd::sinks::base_sink<spd::details::null_mutex> {
 public:
-    SinkLogger(const std::string& logger_name, const Sink& sink, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
+    size_t formatted_bytes() const { return _bytes; }
+
+protected:
+    void sink_it_(const spd::details::log_msg& msg) override
     {
-        if (async_mode) {
-            _logger = std::shared_ptr<spd::async_logger>(new spd::async_logger(logger_name, sink.get_sink(), thread_pool(), g_async_overflow_policy));
-        } else {
-            _logger = std::shared_ptr<spd::logger>(new spd::logger(logger_name, sink.get_sink()));
-        }
+        _buf.clear();
+        formatter_->format(msg, _buf);
+        _bytes += _buf.size();
     }
-    SinkLogger(const std::string& logger_name, const std::vector<Sink>& sink_list, bool async_mode = g_async_mode_on)
-        : Logger(logger_name, async_mode)
-    {
-        std::vector<spd::sink_ptr> sinks;
-        for (auto sink : sink_list)
-            sinks.push_back(sink.get_sink());
+    void flush_() override { }
 
-        if (async_mode) {
-            _logger = std::shared_ptr<spd::async_logger>(new spd::async_logger(logger_name, sinks.begin(), sinks.end(), thread_pool(), g_async_overflow_policy));
-        } else {
-            _logger = std::shared_ptr<spd::logger>(new spd::logger(logger_name, sinks.begin(), sinks.end()));
-        }
-    }
+private:
+    spd::memory_buf_t _buf;
+    size_t _bytes{ 0 };
 };
 
-Logger get(const std::string& name)
+// Average nanoseconds per call of f over iterations calls.
+template <typename F>
+double time_per_call(size_t iterations, const F& f)
 {
-    Logger* logger = access_logger(name);
-    if (logger)
-        return *logger;
-    else
-        throw std::runtime_error(std::string("Logger name: " + name + " could not be found"));
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double)iterations;
 }
 
-void drop(const std::string& name)
+// Cost per call of each layer under a Python log call, measured from C++ so pybind11 dispatch
+// is left out: the raw spdlog::logger and the Logger wrapper, each with a level filtered
+// call, a null sink and a sink that only formats. tests/binding_overhead.py adds the Python
+// side and derives the per layer breakdown. The wrappers are not made by make_logger, so the
+// registry and the loggers of the caller are left alone.
+py::dict benchmark_layers(py::handle msg, size_t iterations, const std::string& pattern)
 {
-    remove_logger(name);
-    spdlog::drop(name);
-}
+    if (iterations == 0)
+        throw std::invalid_argument("iterations must be positive");
+    auto null = std::make_shared<spd::sinks::null_sink_mt>();
+    auto formatting = std::make_shared<format_only_sink>();
+    formatting->set_formatter(structured::make_pattern_formatter(pattern));
 
-void drop_all()
-{
-    remove_logger_all();
-    spdlog::drop_all();
+    spd::logger raw_null("benchmark raw null", null);
+    spd::logger raw_format("benchmark raw format", formatting);
+    raw_null.set_level(spd::level::info);
+    raw_format.set_level(spd::level::info);
+    const spd::string_view_t view = MessageView(msg).view();
+
+    SinkLogger wrapper_null("benchmark wrapper null", std::vector<Sink>{ Sink(null) }, false);
+    SinkLogger wrapper_format("benchmark wrapper format", std::vector<Sink>{ Sink(formatting) }, false);
+    wrapper_null.set_level(LogLevel::info);
+    wrapper_format.set_level(LogLevel::info);
+    wrapper_format.set_pattern(pattern);
+
+    py::dict costs;
+    costs["spdlog_level_check"] = time_per_call(iterations, [&] { raw_null.log(spd::level::debug, view); });
+    costs["spdlog_null_sink"] = time_per_call(iterations, [&] { raw_null.log(spd::level::info, view); });
+    costs["spdlog_format"] = time_per_call(iterations, [&] { raw_format.log(spd::level::info, view); });
+    costs["wrapper_level_check"] = time_per_call(iterations, [&] { wrapper_null.debug(msg); });
+    costs["wrapper_null_sink"] = time_per_call(iterations, [&] { wrapper_null.info(msg); });
+    costs["wrapper_format"] = time_per_call(iterations, [&] { wrapper_format.info(msg); });
+    costs["formatted_bytes"] = formatting->formatted_bytes();
+    wrapper_null.close();
+    wrapper_format.close();
+    return costs;
 }
+#endif
 
 }
 
+// Declares free-threading support, the module's state is guarded by its own locks and atomics.
+#if PYBIND11_VERSION_MAJOR > 2 || (PYBIND11_VERSION_MAJOR == 2 && PYBIND11_VERSION_MINOR >= 13)
+PYBIND11_MODULE(spdlog, m, py::mod_gil_not_used())
+#else
 PYBIND11_MODULE(spdlog, m)
+#endif
 {
     m.doc() = R"pbdoc(
         spdlog module
@@ -705,9 +5075,88 @@ PYBIND11_MODULE(spdlog, m)
         py::arg("thread_count") = 1,
         py::arg("overflow_policy") = 0);
 
-    py::class_<Sink>(m, "Sink")
-        .def(py::init<>())
-        .def("set_level", &Sink::set_level);
+    m.def("set_release_gil", set_release_gil, py::arg("release_gil"),
+        "release the GIL during formatting and sink writes for loggers created afterwards");
+
+    py::class_<AsyncStats, std::shared_ptr<AsyncStats>>(m, "AsyncStats")
+        .def_property_readonly("queue_size", &AsyncStats::queue_size)
+        .def_property_readonly("thread_count", &AsyncStats::thread_count)
+        .def_property_readonly("queue_depth", &AsyncStats::queue_depth)
+        .def_property_readonly("high_water_mark", &AsyncStats::high_water_mark)
+        .def_property_readonly("overrun_count", &AsyncStats::overrun_count)
+        .def_property_readonly("enqueued", &AsyncStats::enqueued)
+        .def_property_readonly("processed", &AsyncStats::processed)
+        .def_property_readonly("processed_per_worker", &AsyncStats::processed_per_worker)
+        .def_property_readonly("latency_histogram", &AsyncStats::latency_histogram,
+            "(upper bound in microseconds, count) pairs of the time from queueing a message until the sinks wrote it")
+        .def("reset", &AsyncStats::reset);
+
+    m.def("async_stats", async_stats, "statistics of the thread pool used by loggers created in async mode");
+
+    py::class_<AsyncPool, std::shared_ptr<AsyncPool>>(m, "ThreadPool")
+        .def(py::init<size_t, size_t, int, const std::vector<int>&, int>(),
+            py::arg("queue_size") = 1 << 16,
+            py::arg("thread_count") = 1,
+            py::arg("overflow_policy") = 0,
+            py::arg("cpu_affinity") = std::vector<int>(),
+            py::arg("nice") = 0,
+            "thread pool for async loggers, workers are pinned to cpu_affinity (linux only) and get the given nice value (0 keeps the inherited one)")
+        .def_property_readonly("queue_size", &AsyncPool::queue_size)
+        .def_property_readonly("thread_count", &AsyncPool::thread_count)
+        .def_property_readonly("overflow_policy", [](const AsyncPool& pool) { return (int)pool.overflow_policy(); })
+        .def_property_readonly("cpu_affinity", &AsyncPool::cpu_affinity)
+        .def_property_readonly("nice", &AsyncPool::nice)
+        .def_property_readonly("stats", &AsyncPool::stats);
+
+    py::class_<LogFilter, std::shared_ptr<LogFilter>>(m, "LogFilter")
+        .def_property_readonly("dropped", &LogFilter::dropped, "number of records rejected by the filter")
+        .def_property_readonly("passed", &LogFilter::passed, "number of records let through by the filter")
+        .def_property_readonly("max_level", &LogFilter::max_level);
+
+    py::class_<RateLimitFilter, LogFilter, std::shared_ptr<RateLimitFilter>>(m, "RateLimitFilter")
+        .def(py::init<double, double, bool, int>(),
+            py::arg("rate"),
+            py::arg("burst") = 0.0,
+            py::arg("per_level") = true,
+            py::arg("max_level") = LogLevel::critical,
+            "token bucket letting through rate records per second with bursts of up to burst records "
+            "(0 uses rate), with a bucket per level when per_level is set; records above max_level always pass");
+
+    py::class_<SampleFilter, LogFilter, std::shared_ptr<SampleFilter>>(m, "SampleFilter")
+        .def(py::init<uint64_t, int>(),
+            py::arg("n"),
+            py::arg("max_level") = LogLevel::critical,
+            "lets through one record out of every n; records above max_level always pass");
+
+    py::class_<DedupFilter, LogFilter, std::shared_ptr<DedupFilter>>(m, "DedupFilter")
+        .def(py::init<double, int>(),
+            py::arg("window") = 1.0,
+            py::arg("max_level") = LogLevel::critical,
+            "drops repeats of the previous record for window seconds, the next record let through is preceded by "
+            "'Skipped N duplicate messages'; records above max_level always pass");
+
+    py::class_<JsonFormatter>(m, "JsonFormatter")
+        .def(py::init<const py::dict&, bool, bool, bool>(),
+            py::arg("static_fields") = py::dict(),
+            py::arg("hostname") = false,
+            py::arg("pid") = false,
+            py::arg("utc") = true,
+            "one JSON object per record with time, level, logger, thread, msg, the fields of structured records and static_fields");
+
+    py::class_<Sink, PySink>(m, "Sink")
+        .def(py::init_alias<size_t, int64_t>(), py::arg("batch_size") = 256, py::arg("max_latency_ms") = 100,
+            "base of sinks implemented in Python, log_batch(records) is called with at most batch_size records "
+            "and records wait at most max_latency_ms milliseconds (0 waits for a full batch or a flush)")
+        .def("log_batch", &Sink::log_batch, py::arg("records"))
+        .def("set_level", &Sink::set_level)
+        .def("flush", &Sink::flush)
+        .def("set_flush_policy", &Sink::set_flush_policy, py::arg("max_bytes") = 0, py::arg("max_ms") = 0,
+            "flush after max_bytes of payload or max_ms milliseconds, whichever comes first; set before handing the sink to a logger")
+        .def("set_pattern", &Sink::set_pattern, py::arg("pattern"))
+        .def("set_formatter", &Sink::set_formatter, py::arg("formatter"),
+            "format records with formatter, Logger.set_pattern replaces it")
+        .def("add_filter", &Sink::add_filter, py::arg("filter"), "add a filter before handing the sink to a logger")
+        .def("filters", &Sink::filters);
 
     py::class_<stdout_sink_st, Sink>(m, "stdout_sink_st")
         .def(py::init<>());
@@ -734,30 +5183,103 @@ PYBIND11_MODULE(spdlog, m)
         .def(py::init<>());
 
     py::class_<basic_file_sink_st, Sink>(m, "basic_file_sink_st")
-        .def(py::init<std::string, bool>(), py::arg("filename"), py::arg("truncate") = false);
+        .def(py::init<std::string, bool, size_t>(), py::arg("filename"), py::arg("truncate") = false, py::arg("buffer_size") = 0);
 
     py::class_<basic_file_sink_mt, Sink>(m, "basic_file_sink_mt")
-        .def(py::init<std::string, bool>(), py::arg("filename"), py::arg("truncate") = false);
+        .def(py::init<std::string, bool, size_t>(), py::arg("filename"), py::arg("truncate") = false, py::arg("buffer_size") = 0);
 
     py::class_<daily_file_sink_st, Sink>(m, "daily_file_sink_st")
-        .def(py::init<std::string, int, int>(), py::arg("filename"),
+        .def(py::init<std::string, int, int, size_t>(), py::arg("filename"),
             py::arg("rotation_hour"),
-            py::arg("rotation_minute"));
+            py::arg("rotation_minute"),
+            py::arg("buffer_size") = 0);
 
     py::class_<daily_file_sink_mt, Sink>(m, "daily_file_sink_mt")
-        .def(py::init<std::string, int, int>(), py::arg("filename"),
+        .def(py::init<std::string, int, int, size_t>(), py::arg("filename"),
             py::arg("rotation_hour"),
-            py::arg("rotation_minute"));
+            py::arg("rotation_minute"),
+            py::arg("buffer_size") = 0);
 
     py::class_<rotating_file_sink_st, Sink>(m, "rotating_file_sink_st")
-        .def(py::init<std::string, int, int>(), py::arg("filename"),
+        .def(py::init<std::string, int, int, size_t>(), py::arg("filename"),
             py::arg("max_size"),
-            py::arg("max_files"));
+            py::arg("max_files"),
+            py::arg("buffer_size") = 0);
 
     py::class_<rotating_file_sink_mt, Sink>(m, "rotating_file_sink_mt")
-        .def(py::init<std::string, int, int>(), py::arg("filename"),
+        .def(py::init<std::string, int, int, size_t>(), py::arg("filename"),
+            py::arg("max_size"),
+            py::arg("max_files"),
+            py::arg("buffer_size") = 0);
+
+#ifndef _WIN32
+    py::class_<mmap_file_sink_st, Sink>(m, "mmap_file_sink_st")
+        .def(py::init<std::string, size_t, bool, bool>(), py::arg("filename"),
+            py::arg("segment_size") = 64 << 20,
+            py::arg("truncate") = false,
+            py::arg("sync_on_flush") = false);
+
+    py::class_<mmap_file_sink_mt, Sink>(m, "mmap_file_sink_mt")
+        .def(py::init<std::string, size_t, bool, bool>(), py::arg("filename"),
+            py::arg("segment_size") = 64 << 20,
+            py::arg("truncate") = false,
+            py::arg("sync_on_flush") = false);
+#endif
+
+#ifdef SPDLOG_ENABLE_ZLIB
+    py::class_<compressed_rotating_file_sink_st, Sink>(m, "compressed_rotating_file_sink_st")
+        .def(py::init<std::string, size_t, size_t, int, bool>(), py::arg("filename"),
+            py::arg("max_size"),
+            py::arg("max_files"),
+            py::arg("compression_level") = 6,
+            py::arg("streaming") = false)
+        .def("compression_stats", &compressed_rotating_file_sink_st::compression_stats);
+
+    py::class_<compressed_rotating_file_sink_mt, Sink>(m, "compressed_rotating_file_sink_mt")
+        .def(py::init<std::string, size_t, size_t, int, bool>(), py::arg("filename"),
             py::arg("max_size"),
-            py::arg("max_files"));
+            py::arg("max_files"),
+            py::arg("compression_level") = 6,
+            py::arg("streaming") = false)
+        .def("compression_stats", &compressed_rotating_file_sink_mt::compression_stats);
+#endif
+
+    py::class_<binary_file_sink_st, Sink>(m, "binary_file_sink_st")
+        .def(py::init<std::string, bool>(), py::arg("filename"), py::arg("truncate") = false);
+
+    py::class_<binary_file_sink_mt, Sink>(m, "binary_file_sink_mt")
+        .def(py::init<std::string, bool>(), py::arg("filename"), py::arg("truncate") = false);
+
+    py::class_<BinaryLogReader>(m, "BinaryLogReader")
+        .def(py::init<std::string>(), py::arg("filename"))
+        .def("read", &BinaryLogReader::read, py::arg("count") = 0,
+            "the next count records as (level, time, thread_id, logger_name, payload) tuples, all remaining ones when count is 0")
+        .def("render", &BinaryLogReader::render, py::arg("output_filename"), py::arg("pattern") = "%+",
+            "write the remaining records as text formatted with pattern, returns their number")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &BinaryLogReader::next);
+
+#ifndef _WIN32
+    py::class_<shared_memory_sink_mt, Sink>(m, "shared_memory_sink_mt")
+        .def(py::init<std::string, int>(), py::arg("name"),
+            py::arg("overflow_policy") = AsyncOverflowPolicy::block,
+            "writes records into the shared memory ring of a SharedMemoryCollector, when the ring is full "
+            "BLOCK waits for the collector and OVERRUN_OLDEST drops the record");
+
+    py::class_<SharedMemoryCollector>(m, "SharedMemoryCollector")
+        .def(py::init<std::string, const std::vector<Sink>&, size_t, bool>(), py::arg("name"),
+            py::arg("sinks"),
+            py::arg("capacity") = 1 << 24,
+            py::arg("force") = false, py::keep_alive<1, 3>(),
+            "a ring left behind by a collector that died is replaced, with force also one still in use")
+        .def("start", &SharedMemoryCollector::start, py::arg("poll_interval_ms") = 1.0)
+        .def("stop", &SharedMemoryCollector::stop)
+        .def("poll", &SharedMemoryCollector::poll)
+        .def_property_readonly("collected", &SharedMemoryCollector::collected)
+        .def_property_readonly("dropped", &SharedMemoryCollector::dropped)
+        .def_property_readonly("capacity", &SharedMemoryCollector::capacity)
+        .def_property_readonly("running", &SharedMemoryCollector::running);
+#endif
 
     py::class_<null_sink_st, Sink>(m, "null_sink_st")
         .def(py::init<>());
@@ -795,14 +5317,31 @@ PYBIND11_MODULE(spdlog, m)
         .value("utc", spdlog::pattern_time_type::utc)
         .export_values();
 
-    py::class_<Logger>(m, "Logger")
+    py::class_<Logger, std::shared_ptr<Logger>>(m, "Logger")
         .def("log", &Logger::log)
+        .def("log", &Logger::log_fmt)
         .def("trace", &Logger::trace)
+        .def("trace", &Logger::trace_fmt)
         .def("debug", &Logger::debug)
+        .def("debug", &Logger::debug_fmt)
         .def("info", &Logger::info)
+        .def("info", &Logger::info_fmt)
         .def("warn", &Logger::warn)
+        .def("warn", &Logger::warn_fmt)
         .def("error", &Logger::error)
+        .def("error", &Logger::error_fmt)
         .def("critical", &Logger::critical)
+        .def("critical", &Logger::critical_fmt)
+        .def("log_kv", &Logger::log_kv, py::arg("level"), py::arg("msg"))
+        .def("trace_kv", &Logger::trace_kv, py::arg("msg"))
+        .def("debug_kv", &Logger::debug_kv, py::arg("msg"))
+        .def("info_kv", &Logger::info_kv, py::arg("msg"))
+        .def("warn_kv", &Logger::warn_kv, py::arg("msg"))
+        .def("error_kv", &Logger::error_kv, py::arg("msg"))
+        .def("critical_kv", &Logger::critical_kv, py::arg("msg"))
+        .def("log_many", &Logger::log_many,
+            py::arg("levels"), py::arg("messages"), py::arg("timestamps") = py::none(),
+            "levels is a single level or one level per message, timestamps are optional seconds since the epoch")
         .def("name", &Logger::name)
         .def("should_log", &Logger::should_log)
         .def("set_level", &Logger::set_level)
@@ -813,72 +5352,128 @@ PYBIND11_MODULE(spdlog, m)
         .def("flush", &Logger::flush)
         .def("close", &Logger::close)
         .def("async_mode", &Logger::async)
+        .def("set_release_gil", &Logger::set_release_gil, py::arg("release_gil"))
+        .def("release_gil", &Logger::release_gil)
         .def("sinks", &Logger::sinks)
+        .def("add_sink", &Logger::add_sink, py::arg("sink"), py::keep_alive<1, 2>())
+        .def("remove_sink", &Logger::remove_sink, py::arg("sink"), "returns False when the sink was not attached")
+        .def("replace_sinks", &Logger::replace_sinks, py::arg("sinks"), py::keep_alive<1, 2>())
+        .def("async_stats", &Logger::async_stats)
         .def("set_error_handler", &Logger::set_error_handler)
-        .def("get_underlying_logger", &Logger::get_underlying_logger);
+        .def("get_underlying_logger", &Logger::get_underlying_logger)
+        .def("enable_backtrace", &Logger::enable_backtrace, py::arg("size"), py::arg("dump_level") = LogLevel::err,
+            py::arg("max_record_size") = 512,
+            "keep the last size records below the level in memory, written when a record at dump_level or above is logged")
+        .def("disable_backtrace", &Logger::disable_backtrace)
+        .def("dump_backtrace", &Logger::dump_backtrace)
+        .def("add_filter", &Logger::add_filter, py::arg("filter"))
+        .def("remove_filter", &Logger::remove_filter, py::arg("filter"))
+        .def("clear_filters", &Logger::clear_filters)
+        .def("filters", &Logger::filters)
+        .def("drain", &Logger::drain, py::arg("timeout") = 5.0,
+            "wait until the messages queued before the call are written and flushed, returns the number still pending");
+
+#if PY_VERSION_HEX >= 0x03070000
+    fast_path::install(m.attr("Logger"));
+#endif
 
-    py::class_<SinkLogger, Logger>(m, "SinkLogger")
-    .def(py::init<const std::string&, const std::vector<Sink>&>(),
+    py::class_<SinkLogger, Logger, std::shared_ptr<SinkLogger>>(m, "SinkLogger")
+    .def(py::init(&make_logger<SinkLogger, const std::string&, const std::vector<Sink>&>),
+        py::arg("name"),
+        py::arg("sinks"), py::keep_alive<1, 3>())
+    .def(py::init(&make_logger<SinkLogger, const std::string&, const std::vector<Sink>&, bool>),
         py::arg("name"),
-        py::arg("sinks"))
-    .def(py::init<const std::string&, const std::vector<Sink>&, bool>(),
+        py::arg("sinks"),
+        py::arg("async_mode"), py::keep_alive<1, 3>())
+    .def(py::init(&make_logger<SinkLogger, const std::string&, const std::vector<Sink>&, bool, std::shared_ptr<AsyncPool>>),
         py::arg("name"),
         py::arg("sinks"),
-        py::arg("async_mode"));
+        py::arg("async_mode") = true,
+        py::arg("thread_pool"), py::keep_alive<1, 3>());
 
-py::class_<ConsoleLogger, Logger>(m, "ConsoleLogger")
-    .def(py::init<std::string, bool, bool, bool>(),
+py::class_<ConsoleLogger, Logger, std::shared_ptr<ConsoleLogger>>(m, "ConsoleLogger")
+    .def(py::init(&make_logger<ConsoleLogger, std::string, bool, bool, bool>),
         py::arg("name"),
         py::arg("multithreaded") = false,
         py::arg("stdout") = true,
         py::arg("colored") = true)
-    .def(py::init<std::string, bool, bool, bool, bool>(),
+    .def(py::init(&make_logger<ConsoleLogger, std::string, bool, bool, bool, bool>),
+        py::arg("name"),
+        py::arg("multithreaded") = false,
+        py::arg("stdout") = true,
+        py::arg("colored") = true,
+        py::arg("async_mode"))
+    .def(py::init(&make_logger<ConsoleLogger, std::string, bool, bool, bool, bool, std::shared_ptr<AsyncPool>>),
         py::arg("name"),
         py::arg("multithreaded") = false,
         py::arg("stdout") = true,
         py::arg("colored") = true,
-        py::arg("async_mode"));
+        py::arg("async_mode") = true,
+        py::arg("thread_pool"));
 
-py::class_<FileLogger, Logger>(m, "FileLogger")
-    .def(py::init<std::string, std::string, bool, bool>(),
+py::class_<FileLogger, Logger, std::shared_ptr<FileLogger>>(m, "FileLogger")
+    .def(py::init(&make_logger<FileLogger, std::string, std::string, bool, bool>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded") = false,
         py::arg("truncate") = false)
-    .def(py::init<std::string, std::string, bool, bool, bool>(),
+    .def(py::init(&make_logger<FileLogger, std::string, std::string, bool, bool, bool>),
+        py::arg("name"),
+        py::arg("filename"),
+        py::arg("multithreaded") = false,
+        py::arg("truncate") = false,
+        py::arg("async_mode"))
+    .def(py::init(&make_logger<FileLogger, std::string, std::string, bool, bool, bool, std::shared_ptr<AsyncPool>>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded") = false,
         py::arg("truncate") = false,
-        py::arg("async_mode"));
-py::class_<RotatingLogger, Logger>(m, "RotatingLogger")
-    .def(py::init<std::string, std::string, bool, int, int>(),
+        py::arg("async_mode") = true,
+        py::arg("thread_pool"));
+py::class_<RotatingLogger, Logger, std::shared_ptr<RotatingLogger>>(m, "RotatingLogger")
+    .def(py::init(&make_logger<RotatingLogger, std::string, std::string, bool, int, int>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded"),
         py::arg("max_file_size"),
         py::arg("max_files"))
-    .def(py::init<std::string, std::string, bool, int, int, bool>(),
+    .def(py::init(&make_logger<RotatingLogger, std::string, std::string, bool, int, int, bool>),
+        py::arg("name"),
+        py::arg("filename"),
+        py::arg("multithreaded"),
+        py::arg("max_file_size"),
+        py::arg("max_files"),
+        py::arg("async_mode"))
+    .def(py::init(&make_logger<RotatingLogger, std::string, std::string, bool, int, int, bool, std::shared_ptr<AsyncPool>>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded"),
         py::arg("max_file_size"),
         py::arg("max_files"),
-        py::arg("async_mode"));
-py::class_<DailyLogger, Logger>(m, "DailyLogger")
-    .def(py::init<std::string, std::string, bool, int, int>(),
+        py::arg("async_mode") = true,
+        py::arg("thread_pool"));
+py::class_<DailyLogger, Logger, std::shared_ptr<DailyLogger>>(m, "DailyLogger")
+    .def(py::init(&make_logger<DailyLogger, std::string, std::string, bool, int, int>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded") = false,
         py::arg("hour") = 0,
         py::arg("minute") = 0)
-    .def(py::init<std::string, std::string, bool, int, int, bool>(),
+    .def(py::init(&make_logger<DailyLogger, std::string, std::string, bool, int, int, bool>),
         py::arg("name"),
         py::arg("filename"),
         py::arg("multithreaded") = false,
         py::arg("hour") = 0,
         py::arg("minute") = 0,
-        py::arg("async_mode"));
+        py::arg("async_mode"))
+    .def(py::init(&make_logger<DailyLogger, std::string, std::string, bool, int, int, bool, std::shared_ptr<AsyncPool>>),
+        py::arg("name"),
+        py::arg("filename"),
+        py::arg("multithreaded") = false,
+        py::arg("hour") = 0,
+        py::arg("minute") = 0,
+        py::arg("async_mode") = true,
+        py::arg("thread_pool"));
 
 //SyslogLogger(const std::string& logger_name, const std::string& ident = "", int syslog_option = 0, int syslog_facilty = (1<<3))
 #ifdef SPDLOG_ENABLE_SYSLOG
@@ -894,24 +5489,71 @@ py::class_<syslog_sink_mt, Sink>(m, "syslog_sink_mt")
         py::arg("syslog_option") = 0,
         py::arg("syslog_facility") = (1 << 3),
         py::arg("enable_formatting") = true);
-    py::class_<SyslogLogger, Logger>(m, "SyslogLogger")
-        .def(py::init<std::string, bool, std::string, int, int>(),
+    py::class_<SyslogLogger, Logger, std::shared_ptr<SyslogLogger>>(m, "SyslogLogger")
+        .def(py::init(&make_logger<SyslogLogger, std::string, bool, std::string, int, int>),
             py::arg("name"),
             py::arg("multithreaded") = false,
             py::arg("ident") = "",
             py::arg("syslog_option") = 0,
             py::arg("syslog_facility") = (1 << 3))
-        .def(py::init<std::string, bool, std::string, int, int, bool>(),
+        .def(py::init(&make_logger<SyslogLogger, std::string, bool, std::string, int, int, bool>),
+            py::arg("name"),
+            py::arg("multithreaded") = false,
+            py::arg("ident") = "",
+            py::arg("syslog_option") = 0,
+            py::arg("syslog_facility") = (1 << 3),
+            py::arg("async_mode"))
+        .def(py::init(&make_logger<SyslogLogger, std::string, bool, std::string, int, int, bool, std::shared_ptr<AsyncPool>>),
             py::arg("name"),
             py::arg("multithreaded") = false,
             py::arg("ident") = "",
             py::arg("syslog_option") = 0,
             py::arg("syslog_facility") = (1 << 3),
-            py::arg("async_mode"));
+            py::arg("async_mode") = true,
+            py::arg("thread_pool"));
 #endif
-    m.def("get", get, py::arg("name"), py::return_value_policy::copy);
+    bind_logging_handler(m);
+
+    m.def("get", get, py::arg("name"));
     m.def("drop", drop, py::arg("name"));
     m.def("drop_all", drop_all);
+    m.def("drain", drain, py::arg("timeout") = 5.0,
+        "wait until the messages queued before the call are written and flushed, returns the number still pending");
+#ifdef SPDLOG_PYTHON_BENCHMARKS
+    m.def("_benchmark_layers", benchmark_layers, py::arg("msg"), py::arg("iterations") = 1000000, py::arg("pattern") = "%+",
+        "nanoseconds per call of the spdlog::logger and Logger wrapper layers called from C++, see tests/binding_overhead.py");
+#endif
+    m.def("flush_every", flush_every, py::arg("seconds"),
+        "flush all loggers periodically from a background thread, 0 disables");
+    m.def("shutdown", shutdown_loggers, py::arg("timeout") = 5.0,
+        "drain every logger, then drop them, returns the number of messages still pending");
+    py::module_::import("atexit").attr("register")(m.attr("shutdown"));
+#if !defined(_WIN32) && PY_VERSION_HEX >= 0x03070000
+    pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
+    py::module_::import("os").attr("register_at_fork")(
+        py::arg("before") = py::cpp_function(before_fork),
+        py::arg("after_in_parent") = py::cpp_function(after_fork_in_parent),
+        py::arg("after_in_child") = py::cpp_function(after_fork_in_child));
+#endif
+
+    // loggers are given the registry's formatter when created, it also renders structured records
+    spdlog::set_formatter(structured::make_pattern_formatter("%+"));
+
+#if PY_VERSION_HEX >= 0x03070000
+    g_context_var = PyContextVar_New("spdlog_context", nullptr);
+    if (g_context_var == nullptr)
+        throw py::error_already_set();
+    m.def("bind_context", [](py::kwargs fields) { return bind_context(fields); },
+        "add fields to every record logged in the current thread or asyncio task, returns a token for reset_context");
+    m.def("reset_context", reset_context, py::arg("token"), "restore the fields bound before the bind_context call returning token");
+    m.def("clear_context", clear_context, "remove the bound fields, returns a token for reset_context");
+    m.def("get_context", get_context, "the fields bound in the current context");
+    py::class_<LogContext>(m, "log_context")
+        .def(py::init([](py::kwargs fields) { return new LogContext(fields); }),
+            "context manager binding fields for the duration of a with block")
+        .def("__enter__", &LogContext::enter, py::return_value_policy::reference_internal)
+        .def("__exit__", &LogContext::exit);
+#endif
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -0,0 +1,40 @@
+import spdlog
+import time
+
+MICROSEC_IN_SEC = 1e6
+BATCH_SIZES = [1, 16, 256, 4096]
+RECORDS = 1 << 18
+MESSAGE = 'x' * 100
+
+
+def per_record_single(logger, batch):
+    start = time.perf_counter()
+    for _ in range(RECORDS // len(batch)):
+        for msg in batch:
+            logger.info(msg)
+    return (time.perf_counter() - start) * MICROSEC_IN_SEC / RECORDS
+
+
+def per_record_batched(logger, batch):
+    start = time.perf_counter()
+    for _ in range(RECORDS // len(batch)):
+        logger.log_many(spdlog.LogLevel.INFO, batch)
+    return (time.perf_counter() - start) * MICROSEC_IN_SEC / RECORDS
+
+
+def run(async_mode):
+    logger = spdlog.SinkLogger(f'batch_{async_mode}', [spdlog.null_sink_mt()], async_mode)
+    print(f"{'async' if async_mode else 'sync'}: microsec per record")
+    print("batch size | info() loop | log_many()")
+    for batch_size in BATCH_SIZES:
+        batch = [MESSAGE] * batch_size
+        single = per_record_single(logger, batch)
+        batched = per_record_batched(logger, batch)
+        print(f"{batch_size:10} | {single:11.3f} | {batched:10.3f}")
+    logger.close()
+
+
+if __name__ == "__main__":
+    run(False)
+    spdlog.set_async_mode(queue_size=1 << 20)
+    run(True)
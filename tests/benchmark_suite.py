@@ -0,0 +1,255 @@
+"""Benchmark matrix over logger classes, sync/async modes, thread counts and message sizes.
+
+Reports per-call latency percentiles, throughput and bytes written per case, writes them as JSON
+and compares them with a baseline produced by an earlier run:
+
+    python tests/benchmark_suite.py --quick --output baseline.json
+    python tests/benchmark_suite.py --quick --baseline baseline.json
+
+Exits with status 1 when a case regressed by more than --threshold against the baseline.
+"""
+import argparse
+import contextlib
+import json
+import os
+import platform
+import statistics
+import sys
+import tempfile
+import threading
+import time
+
+import spdlog
+
+PATTERN = '[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] %v'
+QUEUE_SIZE = 8192
+
+LOGGERS = ['console', 'file', 'rotating', 'daily', 'sink', 'null']
+MODES = ['sync', 'async_block', 'async_overrun']
+THREADS = [1, 2, 4, 8, 16, 32]
+SIZES = [10, 100, 1000, 20000]
+
+QUICK_THREADS = [1, 4]
+QUICK_SIZES = [10, 1000]
+
+
+def make_logger(kind, name, directory, async_mode, pool):
+    filename = os.path.join(directory, 'bench.log')
+    mode = {'async_mode': async_mode}
+    if pool is not None:
+        mode['thread_pool'] = pool
+    if kind == 'console':
+        return spdlog.ConsoleLogger(name, multithreaded=True, stdout=True, colored=False, **mode)
+    if kind == 'file':
+        return spdlog.FileLogger(name, filename, multithreaded=True, truncate=True, **mode)
+    if kind == 'rotating':
+        return spdlog.RotatingLogger(name, filename, multithreaded=True, max_file_size=64 << 20, max_files=3, **mode)
+    if kind == 'daily':
+        return spdlog.DailyLogger(name, filename, multithreaded=True, **mode)
+    if kind == 'sink':
+        sinks = [spdlog.basic_file_sink_mt(filename, True)]
+    elif kind == 'null':
+        sinks = [spdlog.null_sink_mt()]
+    else:
+        raise ValueError('unknown logger ' + kind)
+    return spdlog.SinkLogger(name, sinks, **mode)
+
+
+@contextlib.contextmanager
+def stdout_to_devnull(enabled):
+    """Console loggers write to file descriptor 1, point it at /dev/null while they run."""
+    if not enabled:
+        yield
+        return
+    sys.stdout.flush()
+    saved = os.dup(1)
+    devnull = os.open(os.devnull, os.O_WRONLY)
+    os.dup2(devnull, 1)
+    try:
+        yield
+    finally:
+        os.dup2(saved, 1)
+        os.close(devnull)
+        os.close(saved)
+
+
+def directory_size(directory):
+    return sum(os.path.getsize(os.path.join(directory, f)) for f in os.listdir(directory))
+
+
+def percentile(sorted_samples, fraction):
+    index = min(len(sorted_samples) - 1, int(fraction * len(sorted_samples)))
+    return sorted_samples[index]
+
+
+def records_for(size, budget_bytes, max_records):
+    return max(1000, min(max_records, budget_bytes // size))
+
+
+def run_case(kind, mode, threads_count, size, records, directory):
+    async_mode = mode != 'sync'
+    pool = None
+    if async_mode:
+        policy = spdlog.AsyncOverflowPolicy.BLOCK if mode == 'async_block' else spdlog.AsyncOverflowPolicy.OVERRUN_OLDEST
+        pool = spdlog.ThreadPool(queue_size=QUEUE_SIZE, thread_count=1, overflow_policy=policy)
+    name = 'bench {} {} {} {}'.format(kind, mode, threads_count, size)
+    message = ('0123456789abcdef' * (size // 16 + 1))[:size]
+    per_thread = max(50, records // threads_count)
+    samples = [None] * threads_count
+    barrier = threading.Barrier(threads_count + 1)
+
+    with stdout_to_devnull(kind == 'console'):
+        logger = make_logger(kind, name, directory, async_mode, pool)
+        logger.set_pattern(PATTERN)
+        for _ in range(200):
+            logger.info(message)
+        if async_mode:
+            logger.drain(timeout=60)
+
+        def work(slot):
+            info = logger.info
+            clock = time.perf_counter_ns
+            latencies = []
+            append = latencies.append
+            barrier.wait()
+            for _ in range(per_thread):
+                start = clock()
+                info(message)
+                append(clock() - start)
+            samples[slot] = latencies
+
+        workers = [threading.Thread(target=work, args=(slot,)) for slot in range(threads_count)]
+        for worker in workers:
+            worker.start()
+        barrier.wait()
+        start = time.perf_counter()
+        for worker in workers:
+            worker.join()
+        if async_mode:
+            logger.drain(timeout=120)
+        else:
+            logger.flush()
+        elapsed = time.perf_counter() - start
+        overruns = logger.async_stats().overrun_count if async_mode else 0
+        logger.close()
+
+    latencies = sorted(latency for thread_samples in samples for latency in thread_samples)
+    total = len(latencies)
+    return {
+        'case': '{}/{}/t{}/s{}'.format(kind, mode, threads_count, size),
+        'logger': kind,
+        'mode': mode,
+        'threads': threads_count,
+        'message_size': size,
+        'records': total,
+        'p50_ns': percentile(latencies, 0.50),
+        'p99_ns': percentile(latencies, 0.99),
+        'p999_ns': percentile(latencies, 0.999),
+        'throughput': total / elapsed,
+        'bytes_written': None if kind in ('console', 'null') else directory_size(directory),
+        'overruns': overruns,
+    }
+
+
+def median_result(runs):
+    """Median of every metric over repeated runs of the same case."""
+    result = dict(runs[0])
+    for key in ('p50_ns', 'p99_ns', 'p999_ns', 'throughput'):
+        result[key] = statistics.median(run[key] for run in runs)
+    return result
+
+
+# (metric, True when higher is better)
+COMPARED = [('throughput', True), ('p50_ns', False), ('p99_ns', False)]
+
+
+def compare(results, baseline, threshold):
+    base = {result['case']: result for result in baseline['results']}
+    regressions = []
+    for result in results:
+        old = base.get(result['case'])
+        if old is None:
+            continue
+        for metric, higher_is_better in COMPARED:
+            if not old[metric]:
+                continue
+            change = (result[metric] - old[metric]) / old[metric]
+            if (-change if higher_is_better else change) > threshold:
+                regressions.append((result['case'], metric, old[metric], result[metric], change))
+    return regressions
+
+
+def parse_list(text, convert=str):
+    return [convert(item) for item in text.split(',') if item]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--quick', action='store_true', help='fewer thread counts, sizes and records')
+    parser.add_argument('--loggers', default=','.join(LOGGERS))
+    parser.add_argument('--modes', default=','.join(MODES))
+    parser.add_argument('--threads', help='comma separated thread counts')
+    parser.add_argument('--sizes', help='comma separated message sizes in bytes')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per case, the median of each metric is kept')
+    parser.add_argument('--output', help='write the results as JSON to this file')
+    parser.add_argument('--baseline', help='JSON written by an earlier run to compare against')
+    parser.add_argument('--threshold', type=float, default=0.15, help='relative change reported as a regression')
+    args = parser.parse_args()
+
+    loggers = parse_list(args.loggers)
+    modes = parse_list(args.modes)
+    threads = parse_list(args.threads, int) if args.threads else (QUICK_THREADS if args.quick else THREADS)
+    sizes = parse_list(args.sizes, int) if args.sizes else (QUICK_SIZES if args.quick else SIZES)
+    budget_bytes, max_records = (8 << 20, 10000) if args.quick else (64 << 20, 50000)
+
+    results = []
+    print('{:40} | {:>9} | {:>9} | {:>9} | {:>12} | {:>10}'.format('case', 'p50 ns', 'p99 ns', 'p99.9 ns', 'records/sec', 'MB written'))
+    with tempfile.TemporaryDirectory() as root:
+        for kind in loggers:
+            for mode in modes:
+                for threads_count in threads:
+                    for size in sizes:
+                        runs = []
+                        for run in range(args.repeat):
+                            directory = os.path.join(root, '{}_{}_{}_{}_{}'.format(kind, mode, threads_count, size, run))
+                            os.mkdir(directory)
+                            runs.append(run_case(kind, mode, threads_count, size, records_for(size, budget_bytes, max_records), directory))
+                        result = median_result(runs)
+                        results.append(result)
+                        written = '-' if result['bytes_written'] is None else '{:.1f}'.format(result['bytes_written'] / (1 << 20))
+                        print('{:40} | {:9.0f} | {:9.0f} | {:9.0f} | {:12.0f} | {:>10}'.format(
+                            result['case'], result['p50_ns'], result['p99_ns'], result['p999_ns'], result['throughput'], written))
+
+    report = {
+        'meta': {
+            'spdlog': spdlog.__version__,
+            'python': platform.python_version(),
+            'implementation': platform.python_implementation(),
+            'platform': platform.platform(),
+            'machine': platform.machine(),
+            'cpu_count': os.cpu_count(),
+            'quick': args.quick,
+            'repeat': args.repeat,
+            'pattern': PATTERN,
+            'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        },
+        'results': results,
+    }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = compare(results, baseline, args.threshold)
+        for case, metric, old, new, change in regressions:
+            print('REGRESSION {} {}: {:.0f} -> {:.0f} ({:+.1%})'.format(case, metric, old, new, change))
+        if regressions:
+            return 1
+        print('no regression above {:.0%} against {}'.format(args.threshold, args.baseline))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
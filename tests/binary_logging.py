@@ -0,0 +1,47 @@
+import os
+import spdlog
+import tempfile
+import time
+
+MICROSEC_IN_SEC = 1e6
+RECORDS = 1 << 20
+MESSAGE = 'request served path=/api/v1/items status=200 bytes=5123 user=alice latency_ms=12.5'
+
+SINKS = [
+    ('basic_file_sink_mt', spdlog.basic_file_sink_mt),
+    ('binary_file_sink_mt', spdlog.binary_file_sink_mt),
+]
+
+
+def run(name, make_sink, filename):
+    logger = spdlog.SinkLogger(name, [make_sink(filename)], async_mode=False)
+    start = time.perf_counter()
+    for _ in range(RECORDS):
+        logger.info(MESSAGE)
+    logger.flush()
+    elapsed = time.perf_counter() - start
+    logger.close()
+    return elapsed * MICROSEC_IN_SEC / RECORDS, os.path.getsize(filename)
+
+
+def decode(filename, text_filename):
+    start = time.perf_counter()
+    reader = spdlog.BinaryLogReader(filename)
+    while reader.read(1 << 16):
+        pass
+    read_elapsed = time.perf_counter() - start
+    start = time.perf_counter()
+    spdlog.BinaryLogReader(filename).render(text_filename)
+    render_elapsed = time.perf_counter() - start
+    return read_elapsed * MICROSEC_IN_SEC / RECORDS, render_elapsed * MICROSEC_IN_SEC / RECORDS
+
+
+if __name__ == "__main__":
+    with tempfile.TemporaryDirectory() as directory:
+        print("sink                | microsec per record | file size MB")
+        for name, make_sink in SINKS:
+            filename = os.path.join(directory, name)
+            latency, size = run(name, make_sink, filename)
+            print(f"{name:19} | {latency:19.3f} | {size / (1 << 20):12.1f}")
+        read, render = decode(os.path.join(directory, 'binary_file_sink_mt'), os.path.join(directory, 'rendered.log'))
+        print(f"decoding: read() {read:.3f} microsec per record, render() {render:.3f} microsec per record")
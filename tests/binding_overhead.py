@@ -0,0 +1,46 @@
+import spdlog
+import sys
+import time
+
+ITERATIONS = 1000000
+PATTERN = '%+'
+MESSAGES = [('short', 'request served'), ('long', 'x' * 1000)]
+
+
+def python_per_call(call, msg):
+    start = time.perf_counter_ns()
+    for _ in range(ITERATIONS):
+        call(msg)
+    return (time.perf_counter_ns() - start) / ITERATIONS
+
+
+def empty_loop():
+    start = time.perf_counter_ns()
+    for _ in range(ITERATIONS):
+        pass
+    return (time.perf_counter_ns() - start) / ITERATIONS
+
+
+if __name__ == "__main__":
+    if not hasattr(spdlog, '_benchmark_layers'):
+        sys.exit("spdlog was built without the layer benchmark, rebuild with SPDLOG_PYTHON_BENCHMARKS=1")
+    logger = spdlog.SinkLogger('binding overhead', [spdlog.null_sink_mt()], async_mode=False)
+    logger.set_level(spdlog.LogLevel.INFO)
+    loop = empty_loop()
+    for label, msg in MESSAGES:
+        native = spdlog._benchmark_layers(msg, ITERATIONS, PATTERN)
+        python_info = python_per_call(logger.info, msg) - loop
+        python_debug = python_per_call(logger.debug, msg) - loop
+        layers = [
+            ('pybind11 dispatch', python_info - native['wrapper_null_sink']),
+            ('argument conversion (Logger wrapper)', native['wrapper_null_sink'] - native['spdlog_null_sink']),
+            ('spdlog core + null sink', native['spdlog_null_sink']),
+            ('format', native['spdlog_format'] - native['spdlog_null_sink']),
+        ]
+        print(f"{label} message, {len(msg)} bytes, ns per call")
+        print(f"  disabled level: python {python_debug:.1f} | wrapper {native['wrapper_level_check']:.1f} | spdlog {native['spdlog_level_check']:.1f}")
+        print(f"  enabled, null sink: python {python_info:.1f} | wrapper {native['wrapper_null_sink']:.1f} | spdlog {native['spdlog_null_sink']:.1f}")
+        print(f"  enabled, formatting sink: wrapper {native['wrapper_format']:.1f} | spdlog {native['spdlog_format']:.1f}")
+        for name, cost in layers:
+            print(f"  {name:38} {cost:8.1f}")
+    logger.close()
@@ -0,0 +1,45 @@
+import os
+import spdlog
+import tempfile
+import time
+
+MICROSEC_IN_SEC = 1e6
+RECORDS = 1 << 20
+MAX_SIZE = 16 << 20
+MAX_FILES = 4
+MESSAGE = 'request served path=/api/v1/items status=200 bytes=5123 user=alice latency_ms=12.5'
+
+SINKS = [
+    ('rotating_file_sink_mt', lambda filename: spdlog.rotating_file_sink_mt(filename, MAX_SIZE, MAX_FILES)),
+    ('compressed, level 1', lambda filename: spdlog.compressed_rotating_file_sink_mt(filename, MAX_SIZE, MAX_FILES, compression_level=1)),
+    ('compressed, level 6', lambda filename: spdlog.compressed_rotating_file_sink_mt(filename, MAX_SIZE, MAX_FILES, compression_level=6)),
+    ('streaming, level 1', lambda filename: spdlog.compressed_rotating_file_sink_mt(filename, MAX_SIZE, MAX_FILES, compression_level=1, streaming=True)),
+]
+
+
+def run(name, make_sink, filename):
+    sink = make_sink(filename)
+    logger = spdlog.SinkLogger(name, [sink], async_mode=False)
+    start = time.perf_counter()
+    for i in range(RECORDS):
+        logger.info(MESSAGE)
+    logger.flush()
+    elapsed = time.perf_counter() - start
+    logger.close()
+    if not hasattr(sink, 'compression_stats'):
+        return elapsed * MICROSEC_IN_SEC / RECORDS, None
+    while sink.compression_stats()['pending']:
+        time.sleep(0.01)
+    stats = sink.compression_stats()
+    return elapsed * MICROSEC_IN_SEC / RECORDS, stats
+
+
+if __name__ == "__main__":
+    print("sink                  | microsec per record | ratio | compression MB/s")
+    for name, make_sink in SINKS:
+        with tempfile.TemporaryDirectory() as directory:
+            latency, stats = run(name, make_sink, os.path.join(directory, 'app.log'))
+            if stats:
+                print(f"{name:21} | {latency:19.3f} | {stats['ratio']:5.1f} | {stats['bytes_per_second'] / (1 << 20):16.1f}")
+            else:
+                print(f"{name:21} | {latency:19.3f} |     - |                -")
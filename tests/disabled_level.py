@@ -0,0 +1,33 @@
+import spdlog
+import time
+
+CALLS = 2000000
+MESSAGE = 'cache miss for key 42'
+
+
+def calls_per_sec(call, *args):
+    start = time.perf_counter()
+    for _ in range(CALLS):
+        call(*args)
+    return CALLS / (time.perf_counter() - start)
+
+
+def noop(msg):
+    pass
+
+
+if __name__ == "__main__":
+    logger = spdlog.SinkLogger('disabled level', [spdlog.null_sink_mt()], async_mode=False)
+    logger.set_level(spdlog.LogLevel.INFO)
+    rows = [
+        ('python function (reference)', calls_per_sec(noop, MESSAGE)),
+        ('logger.debug(msg)', calls_per_sec(logger.debug, MESSAGE)),
+        ('logger.debug(format, arg)', calls_per_sec(logger.debug, '{} {}', MESSAGE)),
+        ('logger.log(DEBUG, msg)', calls_per_sec(logger.log, spdlog.LogLevel.DEBUG, MESSAGE)),
+        ('logger.should_log(DEBUG)', calls_per_sec(logger.should_log, spdlog.LogLevel.DEBUG)),
+        ('logger.info(msg), enabled', calls_per_sec(logger.info, MESSAGE)),
+    ]
+    print("call                           | calls per sec")
+    for name, rate in rows:
+        print(f"{name:30} | {rate:13.0f}")
+    logger.close()
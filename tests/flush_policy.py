@@ -0,0 +1,52 @@
+import os
+import spdlog
+import tempfile
+import time
+
+MICROSEC_IN_SEC = 1e6
+RECORDS = 1 << 17
+MESSAGE = 'x' * 100
+
+
+def flush_on_info(filename):
+    sink = spdlog.basic_file_sink_mt(filename)
+    logger = spdlog.SinkLogger('flush_on_info', [sink], async_mode=False)
+    logger.flush_on(spdlog.LogLevel.INFO)
+    return logger
+
+
+def flush_policy(filename):
+    sink = spdlog.basic_file_sink_mt(filename, buffer_size=1 << 20)
+    sink.set_flush_policy(max_bytes=1 << 20, max_ms=200)
+    return spdlog.SinkLogger('flush_policy', [sink], async_mode=False)
+
+
+def no_flush(filename):
+    return spdlog.SinkLogger('no_flush', [spdlog.basic_file_sink_mt(filename)], async_mode=False)
+
+
+STRATEGIES = [
+    ('flush_on(INFO)', flush_on_info),
+    ('1MB / 200ms policy', flush_policy),
+    ('no flush', no_flush),
+]
+
+
+def run(make_logger, filename):
+    logger = make_logger(filename)
+    start = time.perf_counter()
+    for _ in range(RECORDS):
+        logger.info(MESSAGE)
+    logger.flush()
+    elapsed = time.perf_counter() - start
+    logger.close()
+    return elapsed * MICROSEC_IN_SEC / RECORDS, RECORDS / elapsed
+
+
+if __name__ == "__main__":
+    print("strategy           | microsec per record | records per sec")
+    with tempfile.TemporaryDirectory() as directory:
+        for name, make_logger in STRATEGIES:
+            filename = os.path.join(directory, name.replace(' ', '_').replace('/', '') + '.log')
+            latency, throughput = run(make_logger, filename)
+            print(f"{name:18} | {latency:19.3f} | {throughput:15.0f}")
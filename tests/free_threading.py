@@ -0,0 +1,59 @@
+"""Throughput of logging from 1 to N threads, with the speedup over a single thread.
+
+On a free-threaded build (python3.13t) the threads run in parallel and the speedup should
+grow with the number of cores. With the GIL only the time spent with the GIL released
+(set_release_gil) overlaps.
+"""
+import os
+import sys
+import threading
+import time
+
+import spdlog
+
+RECORDS = 200000
+MESSAGE = 'request served in 12 ms'
+
+
+def gil_enabled():
+    check = getattr(sys, '_is_gil_enabled', None)
+    return True if check is None else check()
+
+
+def run(logger, threads_count):
+    per_thread = RECORDS // threads_count
+    barrier = threading.Barrier(threads_count + 1)
+
+    def work():
+        info = logger.info
+        barrier.wait()
+        for _ in range(per_thread):
+            info(MESSAGE)
+
+    workers = [threading.Thread(target=work) for _ in range(threads_count)]
+    for worker in workers:
+        worker.start()
+    barrier.wait()
+    start = time.perf_counter()
+    for worker in workers:
+        worker.join()
+    return per_thread * threads_count / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    print("python {}, GIL {}".format(sys.version.split()[0], 'enabled' if gil_enabled() else 'disabled'))
+    counts = [n for n in (1, 2, 4, 8, 16) if n <= max(1, os.cpu_count() or 1)]
+    for name, async_mode in (('sync null sink', False), ('async null sink', True)):
+        logger = spdlog.SinkLogger(name, [spdlog.null_sink_mt()], async_mode=async_mode)
+        logger.set_pattern('[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] %v')
+        run(logger, 1)
+        print(name)
+        print("threads | records/sec | speedup")
+        single = None
+        for threads_count in counts:
+            rate = run(logger, threads_count)
+            single = single or rate
+            print(f"{threads_count:7} | {rate:11.0f} | {rate / single:6.2f}x")
+        if async_mode:
+            logger.drain(timeout=60)
+        logger.close()
@@ -0,0 +1,98 @@
+"""Per call cost of getting str, bytes and buffer messages into spdlog.
+
+Run it on two builds and compare, e.g. before and after a change to the ingestion path:
+
+    python tests/message_ingestion.py --output before.json    # on the old build
+    python tests/message_ingestion.py --baseline before.json  # on the new build
+
+Payload kinds an older build cannot log (e.g. memoryview) are reported as '-'.
+"""
+import argparse
+import json
+import os
+import sys
+import tempfile
+import time
+
+import spdlog
+
+MICROSEC_IN_SEC = 1e6
+MESSAGE_LENGTHS = [10, 100, 1000, 5000, 20000]
+REPEAT_CNT = 100000
+
+
+def per_call_microsec(logger, message, count):
+    try:
+        logger.info(message)
+    except TypeError:
+        return None
+    start = time.perf_counter()
+    for _ in range(count):
+        logger.info(message)
+    return (time.perf_counter() - start) * MICROSEC_IN_SEC / count
+
+
+def payloads(msg_len):
+    text = 'a' * msg_len
+    raw = text.encode()
+    return {
+        'str': text,
+        'str (non-ascii)': 'á' * (msg_len // 2),
+        'bytes': raw,
+        'memoryview': memoryview(raw),
+    }
+
+
+def cell(value):
+    return '{:>15}'.format('-') if value is None else '{:15.3f}'.format(value)
+
+
+def change(old, new):
+    if old is None or new is None:
+        return '{:>15}'.format('-')
+    return '{:>15}'.format('{:.3f} ({:+.0%})'.format(new, (new - old) / old))
+
+
+def run(name, logger, count, baseline):
+    print(f"{name}: microsec per call" + (" (change against the baseline)" if baseline else ""))
+    kinds = list(payloads(1).keys())
+    print("msg len | " + " | ".join(f"{k:>15}" for k in kinds))
+    results = {}
+    for msg_len in MESSAGE_LENGTHS:
+        timings = {kind: per_call_microsec(logger, p, count) for kind, p in payloads(msg_len).items()}
+        results[str(msg_len)] = timings
+        old = baseline.get(str(msg_len), {}) if baseline else None
+        cells = [change(old.get(kind), timings[kind]) if baseline else cell(timings[kind]) for kind in kinds]
+        print(f"{msg_len:7} | " + " | ".join(cells))
+    logger.close()
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--count', type=int, default=REPEAT_CNT, help='calls per payload')
+    parser.add_argument('--output', help='write the results as JSON to this file')
+    parser.add_argument('--baseline', help='JSON written by a run on another build to compare against')
+    args = parser.parse_args()
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    results = {}
+    # The null sink isolates the cost of getting the message into spdlog.
+    results['null sink'] = run('null sink', spdlog.SinkLogger('ingestion_null', [spdlog.null_sink_st()], async_mode=False),
+                               args.count, baseline.get('null sink'))
+    with tempfile.TemporaryDirectory() as directory:
+        results['file'] = run('file', spdlog.FileLogger('ingestion_file', os.path.join(directory, 'ingestion.log'), async_mode=False),
+                              args.count, baseline.get('file'))
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,37 @@
+import os
+import spdlog
+import tempfile
+import time
+
+MICROSEC_IN_SEC = 1e6
+TOTAL_BYTES = 256 << 20
+RECORD_SIZES = [100, 10 * 1024]
+
+SINKS = [
+    ('basic_file_sink_mt', lambda filename: spdlog.basic_file_sink_mt(filename)),
+    ('mmap_file_sink_mt', lambda filename: spdlog.mmap_file_sink_mt(filename)),
+]
+
+
+def run(name, make_sink, filename, record_size):
+    logger = spdlog.SinkLogger(name, [make_sink(filename)], async_mode=False)
+    logger.set_pattern('%v')
+    message = 'x' * record_size
+    records = TOTAL_BYTES // record_size
+    start = time.perf_counter()
+    for _ in range(records):
+        logger.info(message)
+    logger.flush()
+    elapsed = time.perf_counter() - start
+    logger.close()
+    return elapsed * MICROSEC_IN_SEC / records, TOTAL_BYTES / elapsed / (1 << 20)
+
+
+if __name__ == "__main__":
+    print("sink               | record size | microsec per record | MB per sec")
+    with tempfile.TemporaryDirectory() as directory:
+        for record_size in RECORD_SIZES:
+            for name, make_sink in SINKS:
+                filename = os.path.join(directory, f'{name}_{record_size}.log')
+                latency, throughput = run(name, make_sink, filename, record_size)
+                print(f"{name:18} | {record_size:11} | {latency:19.3f} | {throughput:10.1f}")
@@ -0,0 +1,32 @@
+import spdlog
+import threading
+import time
+
+CALLS = 200000
+THREADS = (1, 2, 4, 8)
+
+
+def lookup(calls):
+    get = spdlog.get
+    for _ in range(calls):
+        get('registry benchmark')
+
+
+def run(threads_count):
+    workers = [threading.Thread(target=lookup, args=(CALLS,)) for _ in range(threads_count)]
+    start = time.perf_counter()
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    elapsed = time.perf_counter() - start
+    return threads_count * CALLS / elapsed
+
+
+if __name__ == "__main__":
+    loggers = [spdlog.ConsoleLogger('registry logger {}'.format(i), async_mode=False) for i in range(100)]
+    logger = spdlog.ConsoleLogger('registry benchmark', async_mode=False)
+    assert spdlog.get('registry benchmark') is logger
+    print("threads | get() calls per sec")
+    for threads_count in THREADS:
+        print(f"{threads_count:7} | {run(threads_count):19.0f}")
@@ -38,11 +38,14 @@ def do_logging(logger, message, count):
 
 
 
+CANDIDATES = ["spdlog", "logging", "bridge"]
+
+
 def build_timings_per_len(message_lengths):
-    timings = {"spdlog" : {}, "logging" : {}}
+    timings = {name : {} for name in CANDIDATES}
     for msg_len in message_lengths:
-        timings["spdlog"][msg_len] = []
-        timings["logging"][msg_len] = []
+        for name in CANDIDATES:
+            timings[name][msg_len] = []
     return timings
 
 
@@ -69,7 +72,7 @@ def mode(data):
     return data[len(data)//2]
 
 def generate_stats(timings):
-    d = {"spdlog": {}, "logging" : {}}
+    d = {name : {} for name in CANDIDATES}
     for logger, time_per_msg_len in timings.items():
         for msg_len, times in time_per_msg_len.items():
            mean = statistics.mean(times)
@@ -113,10 +116,19 @@ def run_test(async_mode):
     standard_logger.addHandler(fh)
     standard_logger.setLevel(logging.DEBUG)
 
+    # stdlib logging routed into an spdlog FileLogger through the native handler
+    bridge_spd_logger = spdlog.FileLogger(name='bridgelogger', filename='bridge.log', multithreaded=False, truncate=False)
+    bridge_logger = logging.getLogger('bridge')
+    bridge_handler = spdlog.LoggingHandler(bridge_spd_logger)
+    bridge_logger.addHandler(bridge_handler)
+    bridge_logger.setLevel(logging.DEBUG)
+    bridge_logger.propagate = False
+
     timings = build_timings_per_len(message_lengths)
 
     candidate_logger(partial(do_logging, spd_logger), 'spdlog', epochs, sub_epochs, repeat_cnt, message_lengths, generate_message, lets_do_some_work, timings)
     candidate_logger(partial(do_logging, standard_logger), 'logging', epochs,sub_epochs, repeat_cnt, message_lengths, generate_message, lets_do_some_work, timings)
+    candidate_logger(partial(do_logging, bridge_logger), 'bridge', epochs,sub_epochs, repeat_cnt, message_lengths, generate_message, lets_do_some_work, timings)
 
 
     final = generate_stats(timings)
@@ -128,12 +140,16 @@ def run_test(async_mode):
 
     for msg_len, ratio in ratios.items():
         print(f"spdlog takes {ratio * 100}% of logging at message len: {msg_len}")
+    ratios = calculate_ratio(final, 'bridge', 'logging')
+    for msg_len, ratio in ratios.items():
+        print(f"logging via spdlog.LoggingHandler takes {ratio * 100}% of logging.FileHandler at message len: {msg_len}")
 
     if async_mode:
-        sleeptime = 4
-        print(f"Sleeping for secs: {sleeptime}")
-        time.sleep(sleeptime)
+        pending = spd_logger.drain(timeout=30)
+        print(f"Drained the async queue, messages still pending: {pending}")
     spd_logger.close()
+    bridge_logger.removeHandler(bridge_handler)
+    bridge_spd_logger.close()
 
 
 if __name__ == "__main__":
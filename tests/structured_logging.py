@@ -0,0 +1,44 @@
+import json
+import os
+import spdlog
+import tempfile
+import time
+
+MICROSEC_IN_SEC = 1e6
+RECORDS = 1 << 18
+FIELDS = {'path': '/api/v1/items', 'status': 200, 'bytes': 5123, 'user': 'alice', 'latency_ms': 12.5, 'cached': False}
+
+
+def make_logger(name, filename, json_format):
+    sink = spdlog.basic_file_sink_mt(filename, True)
+    if json_format:
+        sink.set_formatter(spdlog.JsonFormatter({'service': 'api'}, hostname=True, pid=True))
+    else:
+        sink.set_pattern('%v')
+    return spdlog.SinkLogger(name, [sink], async_mode=False)
+
+
+def json_dumps(logger):
+    for _ in range(RECORDS):
+        logger.info(json.dumps(dict(FIELDS, msg='request served')))
+
+
+def info_kv(logger):
+    for _ in range(RECORDS):
+        logger.info_kv('request served', **FIELDS)
+
+
+if __name__ == "__main__":
+    with tempfile.TemporaryDirectory() as directory:
+        print("method                      | microsec per record | file size MB")
+        for name, log, json_format in (('json.dumps + info', json_dumps, False),
+                                       ('info_kv + JsonFormatter', info_kv, True),
+                                       ('info_kv (logfmt text)', info_kv, False)):
+            filename = os.path.join(directory, name.replace(' ', '_'))
+            logger = make_logger(name, filename, json_format)
+            start = time.perf_counter()
+            log(logger)
+            logger.flush()
+            elapsed = time.perf_counter() - start
+            logger.close()
+            print(f"{name:27} | {elapsed * MICROSEC_IN_SEC / RECORDS:19.3f} | {os.path.getsize(filename) / (1 << 20):12.1f}")
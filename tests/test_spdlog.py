@@ -1,5 +1,16 @@
 import spdlog
+import asyncio
+import gzip
+import json
+import logging
+import os
+import sys
+import tempfile
+import threading
+import time
 import unittest
+import uuid
+import warnings
 
 from spdlog import ConsoleLogger, FileLogger, RotatingLogger, DailyLogger, LogLevel
     
@@ -8,6 +19,34 @@ def set_log_level(logger, level):
     logger.set_level(level)
 
 
+def read_log(logger, filename):
+    logger.flush()
+    with open(filename) as f:
+        return f.read().splitlines()
+
+
+def wait_for(predicate, timeout=5.0):
+    deadline = time.monotonic() + timeout
+    while not predicate():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.01)
+    return True
+
+
+def shared_memory_name(test):
+    """Fresh ring name, unlinked when the test ends even if its collector was not destroyed."""
+    name = 'spdlog-test-{}'.format(uuid.uuid4().hex)
+
+    def unlink():
+        try:
+            os.remove(os.path.join('/dev/shm', name))
+        except OSError:
+            pass
+    test.addCleanup(unlink)
+    return name
+
+
 def log_msg(logger):
     logger.trace('I am Trace')
     logger.debug('I am Debug')
@@ -43,8 +82,847 @@ class SpdLogTest(unittest.TestCase):
                 LogLevel.ERR, LogLevel.CRITICAL):
             set_log_level(logger, level)
             log_msg(logger)
-    
-    
+
+    def test_release_gil(self):
+        logger = ConsoleLogger('Release GIL Logger', False, True, True)
+        self.assertFalse(logger.release_gil())
+        logger.set_release_gil(True)
+        self.assertTrue(logger.release_gil())
+        log_msg(logger)
+        logger.flush()
+        spdlog.drop(logger.name())
+
+        spdlog.set_release_gil(True)
+        try:
+            logger = ConsoleLogger('Release GIL Default Logger', False, True, True)
+            self.assertTrue(logger.release_gil())
+            spdlog.drop(logger.name())
+        finally:
+            spdlog.set_release_gil(False)
+
+    def test_format_args(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'format.log')
+            logger = FileLogger('Format Logger', filename, async_mode=False)
+            logger.set_pattern('%v')
+            logger.set_level(LogLevel.INFO)
+            logger.info('{} {} {} {} {}', 42, 1.5, True, 'str', None)
+            logger.warn('{:>4}|{:.2f}|{name}', 7, 3.14159, name='kw')
+            logger.log(LogLevel.ERR, '{}', 2 ** 80)
+            logger.debug('{}', object())
+            self.assertEqual(read_log(logger, filename),
+                             ['42 1.5 True str None', '   7|3.14|kw', str(2 ** 80)])
+            logger.close()
+
+    def test_message_types(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'types.log')
+            logger = FileLogger('Types Logger', filename, async_mode=False)
+            logger.set_pattern('%v')
+            logger.info('ascii')
+            logger.info('\u00e1rv\u00edzt\u0171r\u0151')
+            logger.info(b'bytes')
+            logger.info(bytearray(b'bytearray'))
+            logger.info(memoryview(b'xxmemoryviewxx')[2:-2])
+            logger.info(12345)
+            self.assertEqual(read_log(logger, filename),
+                             ['ascii', '\u00e1rv\u00edzt\u0171r\u0151', 'bytes', 'bytearray', 'memoryview', '12345'])
+            logger.close()
+
+    def test_log_many(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'many.log')
+            logger = FileLogger('Batch Logger', filename, async_mode=False)
+            logger.set_pattern('%l %v')
+            logger.set_level(LogLevel.INFO)
+            logger.log_many(LogLevel.INFO, ['a', b'b', 'c'])
+            logger.log_many([LogLevel.DEBUG, LogLevel.WARN], (m for m in ['d', 'e']))
+            self.assertEqual(read_log(logger, filename), ['info a', 'info b', 'info c', 'warning e'])
+            # the generator builds every message, only the batch keeps them alive
+            fresh = ['generated {} {}'.format(i, 'x' * 64) for i in range(100)]
+            logger.log_many(LogLevel.INFO, ('generated {} {}'.format(i, 'x' * 64) for i in range(100)))
+            self.assertEqual(read_log(logger, filename)[4:], ['info ' + m for m in fresh])
+
+            logger.set_pattern('%Y-%m-%d %v', spdlog.PatternTimeType.utc)
+            logger.log_many(LogLevel.ERR, ['f'], timestamps=[86400.0])
+            self.assertEqual(read_log(logger, filename)[-1], '1970-01-02 f')
+
+            with self.assertRaises(ValueError):
+                logger.log_many([LogLevel.INFO], ['g', 'h'])
+            logger.close()
+
+    def test_logging_handler(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'bridge.log')
+            logger = FileLogger('Bridge Logger', filename, async_mode=False)
+            logger.set_pattern('%l %! %v')
+            logger.set_level(LogLevel.INFO)
+
+            std_logger = logging.getLogger('spdlog_bridge_test')
+            std_logger.propagate = False
+            std_logger.setLevel(logging.DEBUG)
+            handler = spdlog.LoggingHandler(logger)
+            self.assertIsInstance(handler, logging.Handler)
+            std_logger.addHandler(handler)
+            try:
+                std_logger.debug('filtered by spdlog')
+                std_logger.warning('%s=%d', 'answer', 42)
+                try:
+                    raise KeyError('boom')
+                except KeyError:
+                    std_logger.exception('failed')
+            finally:
+                std_logger.removeHandler(handler)
+
+            lines = read_log(logger, filename)
+            self.assertEqual(lines[0], 'warning test_logging_handler answer=42')
+            self.assertEqual(lines[1], 'error test_logging_handler failed')
+            self.assertEqual(lines[2], 'Traceback (most recent call last):')
+            self.assertEqual(lines[-1], "KeyError: 'boom'")
+            logger.close()
+
+            # errors of the spdlog logger itself go to handleError like any other
+            errors = []
+            handler.handleError = lambda record: errors.append((sys.exc_info()[1], record.getMessage()))
+            std_logger.addHandler(handler)
+            try:
+                std_logger.warning('after close')
+            finally:
+                std_logger.removeHandler(handler)
+            self.assertEqual(len(errors), 1)
+            self.assertIsInstance(errors[0][0], RuntimeError)
+            self.assertEqual(errors[0][1], 'after close')
+
+    def test_async_stats(self):
+        spdlog.set_async_mode(queue_size=1024, thread_count=2)
+        with tempfile.TemporaryDirectory() as directory:
+            logger = FileLogger('Async Stats Logger', os.path.join(directory, 'stats.log'), async_mode=True)
+            stats = logger.async_stats()
+            self.assertEqual(stats.queue_size, 1024)
+            self.assertEqual(stats.thread_count, 2)
+            self.assertEqual(len(logger.sinks()), 1)
+
+            for i in range(100):
+                logger.info('message {}', i)
+            self.assertTrue(wait_for(lambda: stats.processed == 100))
+            self.assertEqual(stats.enqueued, 100)
+            self.assertEqual(sum(stats.processed_per_worker), 100)
+            self.assertEqual(sum(count for _, count in stats.latency_histogram), 100)
+            self.assertGreaterEqual(stats.high_water_mark, 1)
+            self.assertEqual(stats.overrun_count, 0)
+            self.assertEqual(stats.queue_depth, 0)
+
+            stats.reset()
+            self.assertEqual(stats.enqueued, 0)
+            self.assertEqual(stats.processed, 0)
+            self.assertIsNone(FileLogger('Sync Stats Logger', os.path.join(directory, 'sync.log'), async_mode=False).async_stats())
+            spdlog.drop('Sync Stats Logger')
+            logger.close()
+
+    def test_async_stats_with_color_sink(self):
+        # records logged with their own time carry the enqueue time past the color sink
+        spdlog.set_async_mode(queue_size=1024, thread_count=1)
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'color.log')
+            logger = spdlog.SinkLogger('Color Stats Logger', [spdlog.stderr_color_sink_mt(), spdlog.basic_file_sink_mt(filename)], async_mode=True)
+            logger.set_pattern('%^%l%$ %v')
+            stats = logger.async_stats()
+            stats.reset()
+            logger.log_many(LogLevel.INFO, ['a', 'b', 'c'], timestamps=[86400.0] * 3)
+            self.assertTrue(wait_for(lambda: stats.processed == 3))
+            # a stamp lost to the color range would measure the latency from 1970
+            self.assertEqual(sum(count for bound, count in stats.latency_histogram if bound > 60e6), 0)
+            self.assertEqual(read_log(logger, filename), ['info a', 'info b', 'info c'])
+            logger.close()
+
+    def test_thread_pool(self):
+        pool = spdlog.ThreadPool(queue_size=256, thread_count=2)
+        self.assertEqual(pool.queue_size, 256)
+        self.assertEqual(pool.thread_count, 2)
+        with tempfile.TemporaryDirectory() as directory:
+            audit = FileLogger('Audit Logger', os.path.join(directory, 'audit.log'), thread_pool=pool)
+            debug = spdlog.SinkLogger('Debug Logger', [spdlog.null_sink_mt()], thread_pool=pool)
+            self.assertTrue(audit.async_mode())
+            self.assertIs(audit.async_stats(), pool.stats)
+            for i in range(50):
+                audit.info('audit')
+                debug.info('debug')
+            self.assertTrue(wait_for(lambda: pool.stats.processed == 100))
+            audit.close()
+            debug.close()
+
+            with self.assertRaises(ValueError):
+                FileLogger('Sync Pool Logger', os.path.join(directory, 'sync.log'), async_mode=False, thread_pool=pool)
+        with self.assertRaises(ValueError):
+            spdlog.ThreadPool(thread_count=0)
+        if sys.platform.startswith('linux'):
+            self.assertEqual(spdlog.ThreadPool(cpu_affinity=[0]).cpu_affinity, [0])
+
+    def test_drain(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'drain.log')
+            pool = spdlog.ThreadPool(queue_size=1 << 16)
+            logger = FileLogger('Drain Logger', filename, thread_pool=pool)
+            logger.set_pattern('%v')
+            for i in range(10000):
+                logger.info(str(i))
+            self.assertEqual(logger.drain(timeout=10), 0)
+            with open(filename) as f:
+                lines = f.read().splitlines()
+            self.assertEqual(len(lines), 10000)
+            self.assertEqual(lines[-1], '9999')
+            self.assertEqual(spdlog.drain(timeout=1), 0)
+
+            sync_logger = FileLogger('Sync Drain Logger', os.path.join(directory, 'sync.log'), async_mode=False)
+            self.assertEqual(sync_logger.drain(timeout=0), 0)
+            logger.close()
+            sync_logger.close()
+
+    def test_flush_policy(self):
+        with tempfile.TemporaryDirectory() as directory:
+            def file_size(filename):
+                return os.path.getsize(filename) if os.path.exists(filename) else 0
+
+            by_size = os.path.join(directory, 'size.log')
+            sink = spdlog.basic_file_sink_mt(by_size, buffer_size=1 << 16)
+            sink.set_flush_policy(max_bytes=1000)
+            logger = spdlog.SinkLogger('Flush Size Logger', [sink], async_mode=False)
+            logger.set_pattern('%v')
+            logger.info('x' * 500)
+            self.assertEqual(file_size(by_size), 0)
+            logger.info('x' * 500)
+            self.assertEqual(file_size(by_size), 1002)
+
+            by_time = os.path.join(directory, 'time.log')
+            sink = spdlog.basic_file_sink_mt(by_time, buffer_size=1 << 16)
+            sink.set_flush_policy(max_ms=20)
+            timed_logger = spdlog.SinkLogger('Flush Time Logger', [sink], async_mode=False)
+            timed_logger.set_pattern('%v')
+            timed_logger.info('hello')
+            self.assertTrue(wait_for(lambda: file_size(by_time) == 6))
+
+            spdlog.flush_every(0.01)
+            periodic = os.path.join(directory, 'periodic.log')
+            periodic_logger = FileLogger('Flush Every Logger', periodic, multithreaded=True, async_mode=False)
+            periodic_logger.info('hello')
+            self.assertTrue(wait_for(lambda: file_size(periodic) > 0))
+            spdlog.flush_every(0)
+            for l in (logger, timed_logger, periodic_logger):
+                l.close()
+
+    def test_python_sink(self):
+        class Collector(spdlog.Sink):
+            def __init__(self, **kwargs):
+                super().__init__(**kwargs)
+                self.batches = []
+
+            def log_batch(self, records):
+                self.batches.append(records)
+
+            def records(self):
+                return [record for batch in self.batches for record in batch]
+
+        sink = Collector(batch_size=4, max_latency_ms=20)
+        logger = spdlog.SinkLogger('Python Sink Logger', [sink], async_mode=False)
+        before = time.time()
+        for i in range(10):
+            logger.info(str(i))
+        self.assertEqual([len(batch) for batch in sink.batches], [4, 4])
+        self.assertTrue(wait_for(lambda: len(sink.records()) == 10))
+        level, timestamp, thread_id, name, payload = sink.records()[0]
+        self.assertEqual(level, LogLevel.INFO)
+        self.assertGreaterEqual(timestamp, before - 1)
+        self.assertIsInstance(thread_id, int)
+        self.assertEqual(name, 'Python Sink Logger')
+        self.assertEqual([record[4] for record in sink.records()], [str(i) for i in range(10)])
+
+        async_sink = Collector(batch_size=64, max_latency_ms=0)
+        async_logger = spdlog.SinkLogger('Async Python Sink Logger', [async_sink], thread_pool=spdlog.ThreadPool())
+        for i in range(1000):
+            async_logger.info(str(i))
+        self.assertEqual(async_logger.drain(timeout=10), 0)
+        self.assertEqual([record[4] for record in async_sink.records()], [str(i) for i in range(1000)])
+        self.assertTrue(all(len(batch) <= 64 for batch in async_sink.batches))
+        logger.close()
+        async_logger.close()
+
+    @unittest.skipIf(sys.platform == 'win32', 'mmap sink is POSIX only')
+    def test_mmap_file_sink(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'mmap.log')
+            sink = spdlog.mmap_file_sink_mt(filename, segment_size=4096)
+            logger = spdlog.SinkLogger('Mmap Logger', [sink], async_mode=False)
+            logger.set_pattern('%v')
+            for i in range(200):
+                logger.info('{:099}'.format(i))
+            logger.flush()
+            segments = [filename] + [os.path.join(directory, 'mmap.{}.log'.format(i)) for i in range(1, 5)]
+            self.assertTrue(all(os.path.exists(segment) for segment in segments))
+            lines = []
+            for segment in segments:
+                with open(segment) as f:
+                    lines += f.read().rstrip('\0').splitlines()
+            self.assertEqual(lines, ['{:099}'.format(i) for i in range(200)])
+            logger.close()
+
+    @unittest.skipUnless(hasattr(spdlog, 'compressed_rotating_file_sink_mt'), 'built without zlib')
+    def test_compressed_rotating_file_sink(self):
+        for streaming in (False, True):
+            with tempfile.TemporaryDirectory() as directory:
+                filename = os.path.join(directory, 'app.log')
+                sink = spdlog.compressed_rotating_file_sink_mt(filename, max_size=1000, max_files=2, streaming=streaming)
+                logger = spdlog.SinkLogger('Compressed Logger', [sink], async_mode=False)
+                logger.set_pattern('%v')
+                for i in range(100):
+                    logger.info('{:049}'.format(i))
+                logger.flush()
+                rolled = [os.path.join(directory, 'app.{}.log.gz'.format(i)) for i in (2, 1)]
+                self.assertTrue(wait_for(lambda: sink.compression_stats()['pending'] == 0 and all(map(os.path.exists, rolled))))
+                self.assertFalse(os.path.exists(os.path.join(directory, 'app.3.log.gz')))
+                lines = []
+                for name in rolled:
+                    with gzip.open(name, 'rt') as f:
+                        lines += f.read().splitlines()
+                self.assertEqual(lines, ['{:049}'.format(i) for i in range(40, 80)])
+                stats = sink.compression_stats()
+                self.assertGreater(stats['ratio'], 1.0)
+                self.assertGreater(stats['bytes_per_second'], 0)
+                logger.close()
+
+    @unittest.skipUnless(hasattr(spdlog, 'compressed_rotating_file_sink_mt'), 'built without zlib')
+    def test_compressed_rotating_file_sink_resumes_pending(self):
+        with tempfile.TemporaryDirectory() as directory:
+            # left behind by a process that exited before compressing them
+            for i in range(2):
+                with open(os.path.join(directory, 'app.rolling{}.log'.format(i)), 'w') as f:
+                    f.write('left over {}\n'.format(i))
+            sink = spdlog.compressed_rotating_file_sink_mt(os.path.join(directory, 'app.log'), max_size=1000, max_files=3)
+            logger = spdlog.SinkLogger('Resumed Logger', [sink], async_mode=False)
+            logger.set_pattern('%v')
+            for i in range(30):
+                logger.info('{:049}'.format(i))
+            rolled = [os.path.join(directory, 'app.{}.log.gz'.format(i)) for i in (3, 2, 1)]
+            self.assertTrue(wait_for(lambda: sink.compression_stats()['pending'] == 0 and all(map(os.path.exists, rolled))))
+            contents = []
+            for name in rolled:
+                with gzip.open(name, 'rt') as f:
+                    contents.append(f.read().splitlines())
+            self.assertEqual(contents[:2], [['left over 0'], ['left over 1']])
+            self.assertEqual(contents[2], ['{:049}'.format(i) for i in range(20)])
+            logger.close()
+
+    def test_binary_file_sink(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'app.bin')
+            sink = spdlog.binary_file_sink_mt(filename)
+            first = spdlog.SinkLogger('first', [sink], async_mode=False)
+            second = spdlog.SinkLogger('second', [sink], async_mode=False)
+            timestamps = [1700000000.5, 1600000000.25, 1700000001.0]
+            first.log_many(LogLevel.WARN, ['a', 'b', 'c'], timestamps)
+            second.error('unicode \u00e9')
+            first.info('x' * 100000)
+            first.flush()
+
+            records = spdlog.BinaryLogReader(filename).read()
+            self.assertEqual([r[0] for r in records], [LogLevel.WARN] * 3 + [LogLevel.ERR, LogLevel.INFO])
+            self.assertEqual([r[1] for r in records[:3]], timestamps)
+            self.assertEqual([r[3] for r in records], ['first'] * 3 + ['second', 'first'])
+            self.assertEqual([r[4] for r in records], ['a', 'b', 'c', 'unicode \u00e9', 'x' * 100000])
+            self.assertEqual(len(list(spdlog.BinaryLogReader(filename))), 5)
+
+            text = os.path.join(directory, 'app.log')
+            self.assertEqual(spdlog.BinaryLogReader(filename).render(text, '%n %l %v'), 5)
+            with open(text, encoding='utf-8') as f:
+                lines = f.read().splitlines()
+            self.assertEqual(lines[:4], ['first warning a', 'first warning b', 'first warning c', 'second error unicode \u00e9'])
+            first.close()
+            second.close()
+
+    def test_binary_log_reader_rejects_corrupt_size(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'corrupt.bin')
+            with open(filename, 'wb') as f:
+                # magic, then a record whose payload size varint claims 2**35 bytes
+                f.write(b'SPDB\x01' + bytes([2, 0, 2, 0, 0]) + bytes([0x80, 0x80, 0x80, 0x80, 0x80, 0x01]) + b'x')
+            with self.assertRaises(ValueError):
+                spdlog.BinaryLogReader(filename).read()
+            # an unknown tag and an unknown level raise the same error
+            for data in (b'SPDB\x01' + bytes([7]), b'SPDB\x01' + bytes([1, 0, 1]) + b'n' + bytes([2, 0, 99, 0, 0, 0])):
+                with open(filename, 'wb') as f:
+                    f.write(data)
+                with self.assertRaises(ValueError):
+                    spdlog.BinaryLogReader(filename).read()
+
+    def test_binary_log_reader_follows_growing_file(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'growing.bin')
+            sink = spdlog.binary_file_sink_mt(filename)
+            logger = spdlog.SinkLogger('growing', [sink], async_mode=False)
+            logger.info('first')
+            logger.flush()
+            reader = spdlog.BinaryLogReader(filename)
+            logger.info('second ' + 'x' * 100)
+            logger.flush()
+            self.assertEqual([r[4] for r in reader.read()], ['first', 'second ' + 'x' * 100])
+            logger.close()
+
+    @unittest.skipIf(sys.platform == 'win32', 'shared memory rings are POSIX only')
+    def test_shared_memory_sink(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'collected.log')
+            name = shared_memory_name(self)
+            collector = spdlog.SharedMemoryCollector(name, [spdlog.basic_file_sink_st(filename)], capacity=4096)
+            logger = spdlog.SinkLogger('Producer', [spdlog.shared_memory_sink_mt(name)], async_mode=False)
+            logger.set_pattern('%v')
+            for i in range(10):
+                logger.info(str(i))
+            self.assertEqual(collector.poll(), 10)
+
+            collector.start()
+            pid = os.fork() if hasattr(os, 'fork') else -1
+            if pid == 0:
+                child = spdlog.SinkLogger('Child', [spdlog.shared_memory_sink_mt(name)], async_mode=False)
+                for i in range(10, 1000):
+                    child.info(str(i))
+                os._exit(0)
+            if pid > 0:
+                os.waitpid(pid, 0)
+            collector.stop()
+            with open(filename) as f:
+                lines = f.read().splitlines()
+            self.assertEqual([line.split()[-1] for line in lines], [str(i) for i in range(1000 if pid > 0 else 10)])
+            self.assertEqual(collector.dropped, 0)
+
+            dropping = spdlog.SinkLogger('Dropping', [spdlog.shared_memory_sink_mt(name, spdlog.AsyncOverflowPolicy.OVERRUN_OLDEST)], async_mode=False)
+            for i in range(1000):
+                dropping.info('x' * 100)
+            self.assertGreater(collector.dropped, 0)
+            self.assertEqual(collector.poll() + collector.dropped, 1000)
+            logger.close()
+            dropping.close()
+
+    @unittest.skipUnless(hasattr(os, 'fork'), 'needs fork')
+    def test_flush_policy_after_fork(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'forked_policy.log')
+            sink = spdlog.basic_file_sink_mt(filename, buffer_size=1 << 16)
+            sink.set_flush_policy(max_ms=20)
+            logger = spdlog.SinkLogger('Forked Policy Logger', [sink], async_mode=False)
+            logger.set_pattern('%v')
+            logger.info('parent')
+            self.assertTrue(wait_for(lambda: os.path.getsize(filename) == 7))
+            pid = os.fork()
+            if pid == 0:
+                # only the restarted flusher thread can write the record out
+                logger.info('child')
+                os._exit(0 if wait_for(lambda: os.path.getsize(filename) == 13) else 1)
+            _, status = os.waitpid(pid, 0)
+            self.assertEqual(status, 0)
+            logger.close()
+
+    @unittest.skipUnless(hasattr(os, 'fork'), 'needs fork')
+    def test_shared_memory_collector_replaces_stale_ring(self):
+        name = shared_memory_name(self)
+        pid = os.fork()
+        if pid == 0:
+            # exits without destroying the collector, as a crash would
+            spdlog.SharedMemoryCollector(name, [spdlog.null_sink_st()], capacity=4096)
+            os._exit(0)
+        os.waitpid(pid, 0)
+        collector = spdlog.SharedMemoryCollector(name, [spdlog.null_sink_st()], capacity=4096)
+        with self.assertRaises(RuntimeError):
+            spdlog.SharedMemoryCollector(name, [spdlog.null_sink_st()], capacity=4096)
+        del collector
+
+    def test_backtrace(self):
+        with tempfile.TemporaryDirectory() as directory:
+            for async_mode in (False, True):
+                filename = os.path.join(directory, 'backtrace_{}.log'.format(async_mode))
+                logger = FileLogger('Backtrace Logger', filename, multithreaded=True, async_mode=async_mode)
+                logger.set_pattern('%l %v')
+                logger.set_level(LogLevel.INFO)
+                logger.enable_backtrace(3, max_record_size=8)
+                for i in range(5):
+                    logger.debug('debug {}'.format(i))
+                logger.trace('{} {}', 'trace', 5)
+                logger.info('info')
+                logger.error('error')
+                logger.error('again')
+                logger.debug('0123456789')
+                logger.dump_backtrace()
+                self.assertEqual(logger.drain(timeout=10), 0)
+                with open(filename) as f:
+                    lines = f.read().splitlines()
+                start = 'info ****************** Backtrace Start ******************'
+                end = 'info ****************** Backtrace End ********************'
+                self.assertEqual(lines, ['info info', start, 'debug debug 3', 'debug debug 4', 'trace trace 5', end,
+                                         'error error', 'error again', start, 'debug 01234567', end])
+                for size, max_record_size in ((0, 8), (3, 0), (2**16, 2**16), (1, 2**30), (2**30, 1)):
+                    with self.assertRaises(ValueError):
+                        logger.enable_backtrace(size, max_record_size=max_record_size)
+                logger.close()
+
+    def test_filters(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'filters.log')
+            logger = FileLogger('Filter Logger', filename, multithreaded=True, async_mode=False)
+            logger.set_pattern('%l %v')
+            sample = spdlog.SampleFilter(3, max_level=LogLevel.INFO)
+            dedup = spdlog.DedupFilter(window=60)
+            logger.add_filter(sample)
+            logger.add_filter(dedup)
+            for i in range(6):
+                logger.info('sampled {}'.format(i))
+            for i in range(4):
+                logger.warn('repeated')
+            logger.error('{} {}', 'done', 1)
+            self.assertEqual(read_log(logger, filename), ['info sampled 0', 'info sampled 3', 'warning repeated',
+                                                          'warning Skipped 3 duplicate messages', 'error done 1'])
+            self.assertEqual((sample.passed, sample.dropped), (2, 4))
+            self.assertEqual(dedup.dropped, 3)
+            logger.clear_filters()
+            logger.close()
+
+            rate = spdlog.RateLimitFilter(rate=1, burst=2)
+            sink = spdlog.basic_file_sink_mt(os.path.join(directory, 'rate.log'), True)
+            sink.add_filter(rate)
+            self.assertEqual(len(sink.filters()), 1)
+            logger = spdlog.SinkLogger('Rate Logger', [sink], async_mode=False)
+            for i in range(10):
+                logger.info('limited {}'.format(i))
+            logger.flush()
+            self.assertEqual(rate.dropped, 8)
+            logger.close()
+
+    def test_structured_logging(self):
+        with tempfile.TemporaryDirectory() as directory:
+            json_filename = os.path.join(directory, 'structured.json')
+            text_filename = os.path.join(directory, 'structured.log')
+            json_sink = spdlog.basic_file_sink_mt(json_filename, True)
+            text_sink = spdlog.basic_file_sink_mt(text_filename, True)
+            default_filename = os.path.join(directory, 'default.log')
+            default_sink = spdlog.basic_file_sink_mt(default_filename, True)
+            logger = spdlog.SinkLogger('Structured Logger', [json_sink, text_sink, default_sink], async_mode=False)
+            json_sink.set_formatter(spdlog.JsonFormatter({'service': 'api', 'version': 2}, pid=True))
+            text_sink.set_pattern('%l %*')
+            logger.info_kv('user "bob"\nlogged in', user='bob', attempt=3, ratio=0.5, admin=False, token=None,
+                           big=1 << 70, path=os.path)
+            logger.warn('plain \\ text')
+            logger.debug_kv('filtered', user='bob')
+            logger.flush()
+            with open(json_filename) as f:
+                records = [json.loads(line) for line in f]
+            self.assertEqual(len(records), 2)
+            self.assertEqual(records[0]['level'], 'info')
+            self.assertEqual(records[0]['logger'], 'Structured Logger')
+            self.assertEqual(records[0]['msg'], 'user "bob"\nlogged in')
+            self.assertEqual((records[0]['user'], records[0]['attempt'], records[0]['ratio']), ('bob', 3, 0.5))
+            self.assertEqual((records[0]['admin'], records[0]['token'], records[0]['big']), (False, None, 1 << 70))
+            self.assertEqual(records[0]['path'], str(os.path))
+            self.assertEqual((records[0]['service'], records[0]['version'], records[0]['pid']), ('api', 2, os.getpid()))
+            self.assertEqual(records[1]['msg'], 'plain \\ text')
+            self.assertNotIn('user', records[1])
+            self.assertEqual(read_log(logger, text_filename)[1], 'warning ')
+            self.assertTrue(read_log(logger, text_filename)[0].startswith('info user="bob" attempt=3 ratio=0.5 admin=false token=null'))
+            # the default pattern shows the message followed by the fields
+            self.assertTrue(read_log(logger, default_filename)[0].endswith('[info] user "bob"'))
+            self.assertTrue(read_log(logger, default_filename)[1].startswith('logged in user="bob" attempt=3'))
+            with self.assertRaises(ValueError):
+                logger.info_kv('bad', **{'a b': 1})
+            # fields named like the keys of the record itself do not repeat them
+            logger.info_kv('clash', level='mine', time=1, thread=2, service='web', pid=3, other=4)
+            logger.flush()
+            with open(json_filename) as f:
+                pairs = json.loads(f.read().splitlines()[-1], object_pairs_hook=list)
+            keys = [key for key, _ in pairs]
+            self.assertEqual(len(keys), len(set(keys)))
+            record = dict(pairs)
+            self.assertEqual((record['level'], record['service'], record['pid']), ('info', 'api', os.getpid()))
+            self.assertEqual((record['fields.level'], record['fields.time'], record['fields.thread']), ('mine', 1, 2))
+            self.assertEqual((record['fields.service'], record['fields.pid'], record['other']), ('web', 3, 4))
+            with self.assertRaises(ValueError):
+                spdlog.JsonFormatter({'level': 'x'})
+            with self.assertRaises(ValueError):
+                spdlog.JsonFormatter({'pid': 1}, pid=True)
+            logger.close()
+
+    def test_padded_message(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'padded.log')
+            logger = FileLogger('Padded Logger', filename, async_mode=False)
+            logger.set_pattern('[%-8v] [%8v] [%3!v]')
+            logger.info('abcdef')
+            logger.info_kv('abcd', user='bob')
+            self.assertEqual(read_log(logger, filename), ['[abcdef  ] [  abcdef] [abc]', '[abcd    ] [    abcd] [abc]'])
+            logger.set_pattern('[%-12*]')
+            logger.info_kv('abcd', a=1)
+            self.assertEqual(read_log(logger, filename)[-1], '[a=1         ]')
+            logger.close()
+
+    @unittest.skipUnless(sys.version_info >= (3, 7), 'needs contextvars')
+    def test_log_context(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'context.log')
+            sink = spdlog.basic_file_sink_mt(filename, True)
+            sink.set_pattern('%v [%*]')
+            logger = spdlog.SinkLogger('Context Logger', [sink], async_mode=False)
+            token = spdlog.bind_context(request_id='abc', user=7)
+            logger.info('hello')
+            with spdlog.log_context(user='bob'):
+                self.assertEqual(spdlog.get_context(), {'request_id': 'abc', 'user': 'bob'})
+                logger.info_kv('kv', n=1)
+            logger.info('{} {}', 'fmt', 2)
+            thread = threading.Thread(target=logger.info, args=('other thread',))
+            thread.start()
+            thread.join()
+            spdlog.reset_context(token)
+            logger.info('plain')
+
+            async def task(request_id):
+                spdlog.bind_context(request_id=request_id)
+                await asyncio.sleep(0)
+                logger.info('task')
+
+            async def main():
+                await asyncio.gather(task('t1'), task('t2'))
+
+            asyncio.run(main())
+            self.assertEqual(spdlog.get_context(), {})
+            self.assertEqual(read_log(logger, filename), ['hello [request_id="abc" user=7]',
+                                                          'kv [n=1 request_id="abc" user="bob"]',
+                                                          'fmt 2 [request_id="abc" user=7]',
+                                                          'other thread []', 'plain []',
+                                                          'task [request_id="t1"]', 'task [request_id="t2"]'])
+            with self.assertRaises(RuntimeError):
+                spdlog.log_context(user='bob').__exit__(None, None, None)
+            logger.close()
+
+    def test_reconfigure_sinks_under_load(self):
+        threads_count, records = 4, 20000
+        with tempfile.TemporaryDirectory() as directory:
+            for async_mode in (False, True):
+                main_filename = os.path.join(directory, 'main_{}.log'.format(async_mode))
+                debug_filename = os.path.join(directory, 'debug_{}.log'.format(async_mode))
+                main_sink = spdlog.basic_file_sink_mt(main_filename, True)
+                debug_sink = spdlog.basic_file_sink_mt(debug_filename, True)
+                logger = spdlog.SinkLogger('Reconfigured Logger', [main_sink], async_mode=async_mode)
+                logger.set_pattern('%v')
+
+                def work():
+                    for i in range(records):
+                        logger.info('record {}'.format(i))
+
+                workers = [threading.Thread(target=work) for _ in range(threads_count)]
+                for worker in workers:
+                    worker.start()
+                while any(worker.is_alive() for worker in workers):
+                    logger.add_sink(debug_sink)
+                    self.assertTrue(logger.remove_sink(debug_sink))
+                    logger.replace_sinks([main_sink, debug_sink])
+                    logger.replace_sinks([main_sink])
+                for worker in workers:
+                    worker.join()
+                self.assertFalse(logger.remove_sink(debug_sink))
+                self.assertEqual(len(logger.sinks()), 1)
+                self.assertEqual(logger.drain(timeout=30), 0)
+                self.assertEqual(len(read_log(logger, main_filename)), threads_count * records)
+                logger.close()
+
+    def test_concurrent_reconfiguration(self):
+        threads_count, records = 4, 5000
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'concurrent.log')
+            logger = FileLogger('Concurrent Logger', filename, multithreaded=True, async_mode=True)
+            logger.set_pattern('%l %v')
+            logger.set_release_gil(True)
+            errors = []
+            done = threading.Event()
+
+            def guarded(work):
+                def run():
+                    try:
+                        work()
+                    except Exception as e:
+                        errors.append(e)
+                return run
+
+            def log():
+                for i in range(records):
+                    logger.warn('record {}', i)
+                    logger.debug('detail {}', i)
+                    logger.log_many(LogLevel.WARN, ['batch {}'.format(i)])
+
+            def set_level():
+                while not done.is_set():
+                    logger.set_level(LogLevel.DEBUG)
+                    logger.set_level(LogLevel.WARN)
+
+            def reconfigure():
+                sample = spdlog.SampleFilter(1)
+                while not done.is_set():
+                    logger.add_filter(sample)
+                    logger.enable_backtrace(16)
+                    logger.remove_filter(sample)
+                    logger.disable_backtrace()
+
+            def async_mode_and_drop():
+                while not done.is_set():
+                    spdlog.set_async_mode(queue_size=1024)
+                    transient = ConsoleLogger('Concurrent Transient', async_mode=True)
+                    spdlog.drop('Concurrent Transient')
+                    transient.close()
+                    spdlog.drop('Concurrent Logger')
+                    spdlog.set_release_gil(False)
+
+            loggers = [threading.Thread(target=guarded(log)) for _ in range(threads_count)]
+            others = [threading.Thread(target=guarded(work)) for work in (set_level, reconfigure, async_mode_and_drop)]
+            for worker in loggers + others:
+                worker.start()
+            for worker in loggers:
+                worker.join()
+            done.set()
+            for worker in others:
+                worker.join()
+            self.assertEqual(errors, [])
+            self.assertEqual(logger.drain(timeout=30), 0)
+            lines = read_log(logger, filename)
+            self.assertEqual(sum(1 for line in lines if line.startswith('warning ')), 2 * threads_count * records)
+            self.assertTrue(all(line.startswith(('warning ', 'debug ')) for line in lines))
+            logger.close()
+
+    def test_close_while_logging(self):
+        logger = spdlog.SinkLogger('Closing Logger', [spdlog.null_sink_mt()], async_mode=True)
+        started = threading.Barrier(5)
+        errors = []
+
+        def log():
+            handle = spdlog.get('Closing Logger')
+            started.wait()
+            try:
+                while True:
+                    handle.info('{}', 'record')
+                    handle.info('record')
+            except RuntimeError as e:
+                if 'logger is closed' not in str(e):
+                    errors.append(e)
+            except Exception as e:
+                errors.append(e)
+
+        workers = [threading.Thread(target=log) for _ in range(4)]
+        for worker in workers:
+            worker.start()
+        started.wait()
+        time.sleep(0.05)
+        logger.close()
+        for worker in workers:
+            worker.join()
+        self.assertEqual(errors, [])
+
+    def test_get_returns_shared_handle(self):
+        logger = ConsoleLogger('Registry Logger', async_mode=False)
+        handle = spdlog.get('Registry Logger')
+        self.assertIs(handle, logger)
+        self.assertIsInstance(handle, ConsoleLogger)
+        handle.set_level(LogLevel.ERR)
+        self.assertEqual(logger.level(), LogLevel.ERR)
+        logger.close()
+        with self.assertRaises(RuntimeError):
+            spdlog.get('Registry Logger')
+        for call in (lambda: handle.info('closed'), lambda: handle.info('{}', 'closed'), lambda: handle.set_level(LogLevel.INFO),
+                     handle.sinks, handle.flush, handle.level):
+            with self.assertRaisesRegex(RuntimeError, 'logger is closed'):
+                call()
+        transient = ConsoleLogger('Transient Logger', async_mode=False)
+        del transient
+        with self.assertRaises(RuntimeError):
+            spdlog.get('Transient Logger')
+
+    @unittest.skipUnless(hasattr(os, 'fork'), 'needs os.fork')
+    def test_fork_under_load(self):
+        threads_count, records, forks, child_records = 4, 20000, 5, 1000
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'parent.log')
+            pool = spdlog.ThreadPool(queue_size=1024, thread_count=2)
+            logger = FileLogger('Forked Logger', filename, multithreaded=True, truncate=True, async_mode=True, thread_pool=pool)
+            logger.set_pattern('%v')
+
+            def work(slot):
+                for i in range(records):
+                    logger.info('parent {} {}'.format(slot, i))
+
+            def child(child_filename):
+                logger.replace_sinks([spdlog.basic_file_sink_mt(child_filename, True)])
+                for i in range(child_records):
+                    logger.info('child {}'.format(i))
+                if logger.drain(timeout=10) != 0:
+                    return 1
+                with open(child_filename) as f:
+                    return 0 if len(f.read().splitlines()) == child_records else 1
+
+            workers = [threading.Thread(target=work, args=(slot,)) for slot in range(threads_count)]
+            for worker in workers:
+                worker.start()
+            for n in range(forks):
+                child_filename = os.path.join(directory, 'child_{}.log'.format(n))
+                with warnings.catch_warnings():
+                    warnings.simplefilter('ignore', DeprecationWarning)
+                    pid = os.fork()
+                if pid == 0:
+                    code = 1
+                    try:
+                        code = child(child_filename)
+                    finally:
+                        os._exit(code)
+                deadline = time.monotonic() + 30
+                while True:
+                    done, status = os.waitpid(pid, os.WNOHANG)
+                    if done:
+                        break
+                    if time.monotonic() > deadline:
+                        os.kill(pid, 9)
+                        os.waitpid(pid, 0)
+                        self.fail('child {} hung after fork'.format(n))
+                    time.sleep(0.01)
+                self.assertTrue(os.WIFEXITED(status))
+                self.assertEqual(os.WEXITSTATUS(status), 0)
+            for worker in workers:
+                worker.join()
+            self.assertEqual(logger.drain(timeout=30), 0)
+            lines = read_log(logger, filename)
+            self.assertEqual(len(lines), threads_count * records)
+            self.assertEqual(len(set(lines)), threads_count * records)
+            logger.close()
+
+    def test_level_methods_fast_path(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'fast_path.log')
+            logger = FileLogger('Fast Path Logger', filename, multithreaded=True, async_mode=False)
+            logger.set_pattern('%l %v')
+            logger.set_level(LogLevel.INFO)
+            self.assertIsNone(logger.debug(object()))
+            self.assertIsNone(logger.debug('{} {}', 'not', 'formatted'))
+            self.assertIsNone(logger.log(LogLevel.TRACE, 'dropped'))
+            logger.info('plain')
+            logger.info('{} {}', 'fmt', 1)
+            logger.log(LogLevel.WARN, 'by level')
+            logger.log(LogLevel.ERR, '{x}', x='keyword')
+            logger.set_level(LogLevel.DEBUG)
+            logger.debug('now enabled')
+            with self.assertRaises(TypeError):
+                logger.info()
+            with self.assertRaises(TypeError):
+                logger.log('info', 'bad level')
+            # a disabled level rejects the same calls as an enabled one
+            with self.assertRaises(TypeError):
+                logger.trace()
+            with self.assertRaises(TypeError):
+                logger.trace(object(), 'not a format')
+            with self.assertRaises(TypeError):
+                logger.log(LogLevel.TRACE)
+            self.assertEqual(read_log(logger, filename), ['info plain', 'info fmt 1', 'warning by level',
+                                                          'error keyword', 'debug now enabled'])
+            logger.close()
+
        
 if __name__ == "__main__":
     unittest.main()
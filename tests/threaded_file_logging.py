@@ -0,0 +1,56 @@
+import spdlog
+import threading
+import time
+import os
+import tempfile
+
+MESSAGE = 'x' * 1000
+DURATION_SEC = 2.0
+
+
+def lets_do_some_work():
+    x = [i for i in range(1 << 5)]
+    return sum(x)
+
+
+def worker(logger, stop, counts, idx):
+    n = 0
+    while not stop.is_set():
+        logger.info(MESSAGE)
+        lets_do_some_work()
+        n += 1
+    counts[idx] = n
+
+
+def run(thread_count, release_gil, directory):
+    loggers = []
+    for i in range(thread_count):
+        name = f'threaded_{thread_count}_{int(release_gil)}_{i}'
+        logger = spdlog.FileLogger(name, os.path.join(directory, name + '.log'),
+                                   multithreaded=True, truncate=True, async_mode=False)
+        # flush after every record so each call pays for a write() syscall
+        logger.flush_on(spdlog.LogLevel.INFO)
+        logger.set_release_gil(release_gil)
+        loggers.append(logger)
+
+    stop = threading.Event()
+    counts = [0] * thread_count
+    threads = [threading.Thread(target=worker, args=(loggers[i], stop, counts, i)) for i in range(thread_count)]
+    for t in threads:
+        t.start()
+    time.sleep(DURATION_SEC)
+    stop.set()
+    for t in threads:
+        t.join()
+    for logger in loggers:
+        logger.close()
+    return sum(counts) / DURATION_SEC
+
+
+if __name__ == "__main__":
+    with tempfile.TemporaryDirectory() as directory:
+        print("threads | GIL held (msgs/sec) | GIL released (msgs/sec)")
+        for thread_count in (1, 2, 4, 8, 16):
+            held = run(thread_count, False, directory)
+            released = run(thread_count, True, directory)
+            print(f"{thread_count:7} | {held:19.0f} | {released:23.0f}")